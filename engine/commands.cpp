@@ -789,6 +789,10 @@ std::string Commands::build_llama_server_cmd(const std::string& server_bin, cons
         if (!abs_model.empty())
             effective_model = abs_model;
         cmd << " -m \"" << effective_model << "\"";
+        std::string mmproj = ModelManager::get_mmproj_path(effective_model);
+        if (tools::FileOps::file_exists(mmproj)) {
+            cmd << " --mmproj \"" << mmproj << "\"";
+        }
     } else if (!models_dir.empty()) {
         std::string dir_arg = tools::FileOps::absolute_path(models_dir);
         if (dir_arg.empty())
@@ -800,6 +804,7 @@ std::string Commands::build_llama_server_cmd(const std::string& server_bin, cons
     if (ctx_size > 0) {
         cmd << " -c " << ctx_size;
     }
+    cmd << tools::SystemInfo::llama_server_thread_args(0, 0, NumaStrategy::Disabled);
 
     // Add --path flag to use Delta web UI if found (required for UI to load)
     if (!public_path.empty()) {
@@ -1363,6 +1368,7 @@ void Commands::init() {
     command_map_["use"] = handle_use;
     command_map_["available"] = handle_available;
     command_map_["list-available"] = handle_available;
+    command_map_["switch"] = handle_switch_session;
     command_map_["clear-screen"] = handle_clear_screen;
     command_map_["help"] = handle_help;
 
@@ -1415,6 +1421,8 @@ void Commands::show_help() {
     std::cout << "  " << UI::GREEN << "/list" << UI::RESET << "                 - List local models" << std::endl;
     std::cout << "  " << UI::GREEN << "/available" << UI::RESET << "            - List available models" << std::endl;
     std::cout << "  " << UI::GREEN << "/use <model>" << UI::RESET << "          - Switch to another model" << std::endl;
+    std::cout << "  " << UI::GREEN << "/switch <session>" << UI::RESET << "     - Switch to another chat session"
+              << std::endl;
     std::cout << "  " << UI::GREEN << "/clear-screen" << UI::RESET << "         - Clear the terminal screen"
               << std::endl;
     std::cout << "  " << UI::GREEN << "/help" << UI::RESET << "                 - Show this help" << std::endl;
@@ -1444,36 +1452,9 @@ bool Commands::handle_download(const std::vector<std::string>& args, Interactive
     std::string model_name = args[0];
     UI::print_info("Downloading model: " + model_name);
 
-    // Set progress callback for download with visual progress bar (ASCII on Windows to avoid garbled output)
+    // Set progress callback for download with visual progress bar
     session.model_mgr->set_progress_callback([](double progress, long long current, long long total) {
-        double current_mb = current / (1024.0 * 1024.0);
-        double total_mb = total / (1024.0 * 1024.0);
-        int bar_width = 50;
-        int pos = (int)(progress / 100.0 * bar_width);
-        std::cout << "\r  [";
-#ifdef _WIN32
-        for (int i = 0; i < bar_width; i++) {
-            if (i < pos)
-                std::cout << "#";
-            else if (i == pos)
-                std::cout << ">";
-            else
-                std::cout << "-";
-        }
-#else
-        for (int i = 0; i < bar_width; i++) {
-            if (i < pos)
-                std::cout << "█";
-            else if (i == pos)
-                std::cout << "▓";
-            else
-                std::cout << "░";
-        }
-#endif
-        std::cout << "] " << std::fixed << std::setprecision(1) << progress << "% ";
-        std::cout << "(" << std::fixed << std::setprecision(1) << current_mb << " / ";
-        std::cout << total_mb << " MB)";
-        std::cout << std::flush;
+        UI::print_download_progress(progress, current, total);
     });
 
     bool success = session.model_mgr->pull_model(model_name);
@@ -1546,8 +1527,16 @@ bool Commands::handle_use(const std::vector<std::string>& args, InteractiveSessi
     UI::print_info("Switching to model: " + model_name);
     UI::print_info("Loading model...");
 
-    // Update config
+    // Keep the outgoing model's KV cache so switching back does not re-prefill
+    std::string session_dir = get_history_manager().get_session_dir();
+    session.engine->save_session_state(session_dir);
+
+    // Update config; the projector belongs to the previous model
     session.config->model_path = model_path;
+    session.config->mmproj_path.clear();
+    if (tools::FileOps::file_exists(ModelManager::get_mmproj_path(model_path))) {
+        session.config->mmproj_path = ModelManager::get_mmproj_path(model_path);
+    }
     session.current_model = model_name;
 
     // Reload model
@@ -1555,8 +1544,12 @@ bool Commands::handle_use(const std::vector<std::string>& args, InteractiveSessi
         UI::print_error("Failed to load model: " + model_name);
         return true;
     }
+    session.engine->load_session_state(session_dir);
 
     UI::print_info("✓ Model loaded successfully!");
+    if (session.engine->get_warmup_ms() > 0.0) {
+        UI::print_info("Warm-up: " + std::to_string(static_cast<int>(session.engine->get_warmup_ms() + 0.5)) + " ms");
+    }
     UI::print_info("Current model: " + session.current_model);
 
     // Automatically launch web UI server with the new model
@@ -1709,8 +1702,35 @@ bool Commands::handle_clear_screen(const std::vector<std::string>& args, Interac
     return true;
 }
 
+bool Commands::handle_switch_session(const std::vector<std::string>& args, InteractiveSession& session) {
+    if (args.empty()) {
+        UI::print_error("Please specify a session name");
+        UI::print_info("Usage: /switch <session-name>");
+        return true;
+    }
+
+    auto& history_mgr = get_history_manager();
+
+    // Snapshot the KV cache of the session we are leaving
+    session.engine->save_session_state(history_mgr.get_session_dir());
+
+    if (!history_mgr.switch_session(args[0])) {
+        UI::print_error("Session not found: " + args[0]);
+        return true;
+    }
+    UI::print_info("Current session: " + history_mgr.get_current_session_name());
+
+    // Resume from the saved KV cache instead of re-evaluating the conversation
+    session.engine->reset_cache();
+    if (session.engine->load_session_state(history_mgr.get_session_dir())) {
+        UI::print_info("Restored " + std::to_string(session.engine->get_cached_token_count()) +
+                       " cached tokens");
+    }
+    return true;
+}
+
 // Removed: handle_history, handle_delete_history, handle_new_session, handle_list_sessions,
-//          handle_switch_session, handle_delete_session, handle_active_session, handle_export_session
+//          handle_delete_session, handle_active_session, handle_export_session
 //          - commands removed for simplicity
 
 } // namespace delta
@@ -81,6 +81,7 @@ public:
     static bool handle_list(const std::vector<std::string>& args, InteractiveSession& session);
     static bool handle_use(const std::vector<std::string>& args, InteractiveSession& session);
     static bool handle_available(const std::vector<std::string>& args, InteractiveSession& session);
+    static bool handle_switch_session(const std::vector<std::string>& args, InteractiveSession& session);
     static bool handle_clear_screen(const std::vector<std::string>& args, InteractiveSession& session);
     static bool handle_help(const std::vector<std::string>& args, InteractiveSession& session);
     
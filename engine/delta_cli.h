@@ -2,14 +2,28 @@
 #define DELTA_CLI_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdio>
+#include <cstdint>
 #include <map>
 #include <list>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <thread>
 
 // Forward declarations for llama.cpp types
 struct llama_model;
 struct llama_context;
 struct llama_sampler;
+struct mtmd_context;
+struct mtmd_input_chunk;
 
 namespace delta {
 
@@ -30,6 +44,12 @@ public:
     static void clear_line();
     static std::string get_input();
     
+    // Redraw the download progress line ("\r<label> [bar] 12.3% (a / b MB)"). libcurl
+    // reports progress many times per frame, so each label's redraws are limited to a
+    // fixed frame rate; the final 100% frame is always drawn.
+    static void print_download_progress(double progress, long long current, long long total,
+                                        const std::string& label = "");
+    
     // Internationalization support
     static std::string format_size(long long bytes);
     static std::string format_number(long long number);
@@ -101,6 +121,8 @@ private:
 // Models Module - Model management and downloads
 // ============================================================================
 
+class DownloadJob;
+
 // Model registry entry
 struct ModelRegistry {
     std::string name;           // e.g., "qwen2.5:0.5b" (registry key with colon)
@@ -112,6 +134,8 @@ struct ModelRegistry {
     std::string description;    // Description for UI
     std::string display_name;   // e.g., "Qwen 2.5 0.5B" (for friendly output)
     int max_context;            // Maximum usable context size for llama-server (-c parameter)
+    std::string mmproj_filename = "";   // vision projector in the same repo (empty = text only)
+    std::string sha256 = "";            // expected SHA-256 of filename (hex); empty = the digest Hugging Face reports
 };
 
 class ModelManager {
@@ -148,6 +172,11 @@ public:
     bool pull_model(const std::string& model_name, 
                    const std::string& quantization = "Q4_K_M");
     
+    // Run a queued download on the calling thread, reporting progress to the job and
+    // aborting when the job is cancelled. DownloadScheduler workers call this; several
+    // jobs may run at once, each on its own curl handle.
+    bool pull_model(DownloadJob& job);
+    
     // Get available models from registry (not yet downloaded)
     std::vector<ModelRegistry> get_registry_models();
     
@@ -175,6 +204,10 @@ public:
     // Check if model is installed locally
     bool is_model_installed(const std::string& model_name);
     
+    // Where the vision projector for a model file lives: "<model>.mmproj" next to it
+    // (not .gguf, so it is never listed or served as a model). The file may not exist.
+    static std::string get_mmproj_path(const std::string& model_path);
+    
     // Get friendly model info for display
     struct ModelInfo {
         std::string name;
@@ -188,12 +221,20 @@ public:
     std::vector<ModelInfo> get_friendly_model_list(bool include_available = false);
     
     // Download progress callback
-    typedef void (*ProgressCallback)(double progress, long long current, long long total);
+    typedef std::function<void(double progress, long long current, long long total)> ProgressCallback;
     void set_progress_callback(ProgressCallback callback);
     
-    // Request cancellation of any in-progress download (checked via progress callback).
+    // Request cancellation of every in-progress download (checked via progress callback).
     void cancel_download();
     
+    // Cancel only the in-progress downloads of one model; false if none was running
+    bool cancel_download(const std::string& model_name);
+    
+    // Connections per large download: the file is fetched as that many byte ranges at
+    // once (not on Windows). 1 downloads over a single stream.
+    static constexpr int kDefaultDownloadConnections = 4;
+    void set_download_connections(int connections);
+    
     // ===== DEFAULT MODEL SUPPORT =====
     
     // Get the default model name (registry format: "qwen3:0.6b")
@@ -212,6 +253,7 @@ public:
 private:
     std::string models_dir_;
     ProgressCallback progress_callback_;
+    int download_connections_ = kDefaultDownloadConnections;
     
     // Default model constant
     static const std::string DEFAULT_MODEL_NAME;
@@ -228,23 +270,215 @@ private:
     void load_context_overrides();
     void save_context_overrides();
     
-    // HTTP download helper using libcurl
+    // HTTP download helper using libcurl; progress goes to the job, which can abort it.
+    // Large files are fetched as parallel byte ranges. Partial data is kept in "<dest>.tmp"
+    // and continued when the remote file is unchanged (ETag/Last-Modified and segment
+    // progress recorded in "<dest>.tmp.meta").
+    // The file's SHA-256 is computed as it streams in and checked against expected_sha256
+    // (or the digest Hugging Face reports); mismatches are moved to "quarantine/".
     bool download_file(const std::string& url, 
                       const std::string& dest_path,
-                      ProgressCallback progress = nullptr);
+                      DownloadJob& job,
+                      const std::string& expected_sha256 = "");
     
     // Construct Hugging Face URL
     std::string get_hf_url(const std::string& repo_id, const std::string& filename);
+    
+    // Fetch the entry's vision projector next to model_path if it has one and it is missing
+    bool pull_mmproj(const ModelRegistry& entry, const std::string& model_path, DownloadJob& job);
+    
+    // Body of pull_model(job): resolve the registry entry and fetch the model and projector
+    bool pull_registry_model(DownloadJob& job);
+};
+
+// One model download: its own transfer, progress state and cancel token
+class DownloadJob {
+public:
+    enum class State { Queued, Running, Completed, Failed, Cancelled };
+    
+    explicit DownloadJob(const std::string& model_name,
+                         ModelManager::ProgressCallback progress = nullptr);
+    
+    const std::string& model_name() const { return model_name_; }
+    State state() const;
+    bool finished() const;
+    
+    // Abort at libcurl's next progress tick, or skip the job if it has not started yet
+    void cancel() { cancel_requested_.store(true); }
+    bool cancel_requested() const { return cancel_requested_.load(); }
+    
+    // Block until the job has finished; true if the model was downloaded
+    bool wait();
+    
+    // Why a failed job failed, when the download stopped on an exception ("" otherwise)
+    std::string error() const;
+    
+    // Progress of the file currently being transferred (percent, bytes)
+    double progress() const { return progress_.load(); }
+    long long current_bytes() const { return current_bytes_.load(); }
+    long long total_bytes() const { return total_bytes_.load(); }
+    
+    // Record transfer progress and forward it to the job's callback (transfer thread)
+    void report_progress(double progress, long long current, long long total);
+    
+private:
+    friend class ModelManager;
+    
+    void start();
+    void finish(bool success, const std::string& error = "");
+    
+    std::string model_name_;
+    ModelManager::ProgressCallback progress_callback_;
+    std::atomic<bool> cancel_requested_{false};
+    std::atomic<double> progress_{0.0};
+    std::atomic<long long> current_bytes_{0};
+    std::atomic<long long> total_bytes_{0};
+    
+    mutable std::mutex mutex_;
+    std::condition_variable finished_cv_;
+    State state_ = State::Queued;
+    std::string error_;
+};
+
+// Runs model downloads on a fixed pool of workers so several models download at once
+// without opening an unbounded number of connections. Jobs beyond the limit wait in FIFO order.
+class DownloadScheduler {
+public:
+    static constexpr size_t kDefaultMaxConcurrent = 3;
+    
+    explicit DownloadScheduler(ModelManager& manager, size_t max_concurrent = kDefaultMaxConcurrent);
+    ~DownloadScheduler();   // cancels outstanding jobs and joins the workers
+    
+    DownloadScheduler(const DownloadScheduler&) = delete;
+    DownloadScheduler& operator=(const DownloadScheduler&) = delete;
+    
+    // Called on the worker thread once a job has finished (completed, failed or cancelled)
+    using FinishCallback = std::function<void(DownloadJob& job)>;
+    
+    // Queue a download. If the model is already queued or running, that job is returned
+    // instead and the callbacks are ignored.
+    std::shared_ptr<DownloadJob> submit(const std::string& model_name,
+                                        ModelManager::ProgressCallback progress = nullptr,
+                                        FinishCallback on_finish = nullptr);
+    
+    // Queued or running job for a model, or null
+    std::shared_ptr<DownloadJob> find(const std::string& model_name) const;
+    
+    // Cancel one model's job; false if it has none
+    bool cancel(const std::string& model_name);
+    void cancel_all();
+    
+    // Block until every submitted job has finished
+    void wait_all();
+    
+    size_t max_concurrent() const { return workers_.size(); }
+    
+private:
+    struct Entry {
+        std::shared_ptr<DownloadJob> job;
+        FinishCallback on_finish;
+    };
+    
+    void worker_loop();
+    std::string job_key(const std::string& model_name) const;
+    
+    ModelManager& manager_;
+    std::vector<std::thread> workers_;
+    
+    mutable std::mutex mutex_;
+    std::condition_variable queue_cv_;
+    std::condition_variable idle_cv_;
+    std::deque<Entry> queue_;
+    std::map<std::string, std::shared_ptr<DownloadJob>> active_;   // queued + running, by job key
+    size_t pending_ = 0;    // jobs whose finish callback has not returned yet
+    bool stopping_ = false;
+};
+
+// Resume metadata kept next to a partial download in "<dest>.tmp.meta"
+struct ResumeInfo {
+    // Byte range [start, end) of a segmented download, of which `done` bytes are on disk
+    struct Segment {
+        long long start = 0;
+        long long end = 0;
+        long long done = 0;
+        bool complete() const { return start + done >= end; }
+    };
+    
+    std::string url;
+    std::string etag;
+    std::string last_modified;
+    long long size = -1;    // full file size, -1 if the server did not say
+    std::vector<Segment> segments;  // empty for a single-stream download
+    std::string hash_state;         // SHA-256 midstate of the verified prefix (tools::Sha256::save_state)
+    bool accept_ranges = false;     // from the probe; not persisted
+    std::string linked_sha256;      // Hugging Face's X-Linked-Etag (LFS SHA-256); not persisted
+};
+
+// Decides whether a partial download can be continued or has to start over: the
+// sidecar file, the validators of the remote file and the server's response
+class DownloadResume {
+public:
+    // Tab-separated "key\tvalue" lines; read() is false if the file is missing or corrupt
+    static bool read(const std::string& path, ResumeInfo& info);
+    static void write(const std::string& path, const ResumeInfo& info);
+    
+    static bool has_validator(const ResumeInfo& info);
+    // True if a fresh probe (`remote`) still describes the file `saved` was downloading
+    static bool same_remote_file(const ResumeInfo& saved, const ResumeInfo& remote);
+    // Apply one response header line (from libcurl's header callback) to `info`
+    static void parse_header(const std::string& header, ResumeInfo& info);
+    // A resumed request answered 200 instead of 206 carries the whole file
+    static bool range_ignored(long long offset, long response_code);
+    
+    // Smallest range worth its own connection in a segmented download
+    static constexpr long long kMinSegmentBytes = 16LL * 1024 * 1024;
+    
+    // Split [begin, size) into up to `connections` ranges of at least kMinSegmentBytes
+    static std::vector<ResumeInfo::Segment> plan_segments(long long begin, long long size, int connections);
+    // Segments to continue with: the saved ones, or else a plan for the rest of a
+    // single-stream partial of `single_stream_offset` bytes
+    static std::vector<ResumeInfo::Segment> resume_segments(const ResumeInfo* saved, long long single_stream_offset,
+                                                            long long size, int connections);
+    // End of the bytes on disk that follow the hash position `pos` without a gap
+    static long long hashable_end(const std::vector<ResumeInfo::Segment>& segments, long long pos);
 };
 
 // ============================================================================
 // Inference Module - llama.cpp integration
 // ============================================================================
+// How llama.cpp spreads threads and memory across NUMA nodes (mirrors ggml_numa_strategy)
+enum class NumaStrategy {
+    Disabled,
+    Distribute,     // spread execution evenly over all nodes
+    Isolate,        // only use the node the process started on
+    Numactl         // follow the CPU map given by numactl
+};
+
+// Element type of the K/V cache. Quantized types roughly halve (q8_0) or quarter
+// (q4_0) KV memory; a quantized V cache needs flash attention.
+enum class KvCacheType {
+    F16,
+    Q8_0,
+    Q4_0
+};
+
+enum class FlashAttention {
+    Auto,           // let llama.cpp decide per device
+    On,
+    Off
+};
+
 struct InferenceConfig {
     std::string model_path;
     int n_ctx = 0;           // context size
-    int n_batch = 512;          // batch size
-    int n_threads = 4;          // CPU threads
+    int n_batch = 512;          // batch size (prompt tokens submitted per llama_decode call)
+    int n_ubatch = 512;         // physical micro-batch size used inside llama_decode
+    int n_threads = 0;          // decode threads (0 = one per physical core)
+    int n_threads_batch = 0;    // prompt/batch threads (0 = one per logical core)
+    NumaStrategy numa = NumaStrategy::Disabled;
+    KvCacheType kv_type_k = KvCacheType::F16;
+    KvCacheType kv_type_v = KvCacheType::F16;
+    FlashAttention flash_attn = FlashAttention::Auto;
     int n_gpu_layers = 0;       // GPU layers (0 = CPU only)
     float temperature = 0.8f;
     float top_p = 0.95f;
@@ -253,7 +487,276 @@ struct InferenceConfig {
     float repeat_penalty = 1.1f;
     bool use_mmap = true;
     bool use_mlock = false;
+    bool warmup = true;         // prefetch the weights and run one dummy decode at load
     bool multimodal = false;    // Enable image inputs
+    std::string mmproj_path;    // vision projector GGUF used by generate_multimodal()
+    std::string image_cache_dir;    // encoded image cache ("" = ~/.delta-cli/cache/image_embeddings)
+    int n_parallel = 1;         // sequences decoded together by generate_batch(); n_ctx is then per sequence
+    std::string draft_model_path;   // small model with the same vocab for speculative decoding
+    int n_draft = 8;            // max tokens drafted per verification step
+    float draft_p_min = 0.75f;  // stop drafting once the draft model is less confident than this
+    int lookup_ngram = 0;       // draft-free speculation: match the last n tokens against the context (0 = off)
+    bool context_shift = false; // when the context is full, drop old tokens instead of stopping
+    int n_keep = 4;             // tokens at the start of the context that are never shifted out
+    std::string grammar;        // GBNF grammar the output must match ("" = unconstrained)
+    std::string json_schema;    // JSON schema the output must match; takes precedence over grammar
+    int sentence_stop_tokens = 25;  // stop at the first sentence end after this many tokens (0 = off)
+    int repeat_stop_ngram = 12;     // stop when a block of at least this many tokens (0 = off)...
+    int repeat_stop_count = 3;      // ...is repeated back to back this many times...
+    int repeat_stop_window = 256;   // ...with copies at most this many tokens apart
+};
+
+// One turn of a conversation rendered by InferenceEngine::format_chat()
+struct ChatMessage {
+    std::string role;       // "system", "user" or "assistant"
+    std::string content;
+};
+
+// Timing and cache statistics for the most recent generate() call
+struct GenerationStats {
+    int n_prompt_tokens = 0;    // tokens in the submitted prompt
+    int n_reused_tokens = 0;    // prompt tokens served from the KV cache (not re-decoded)
+    int n_generated_tokens = 0;
+    double prefill_ms = 0.0;    // time spent decoding the uncached prompt suffix
+    double decode_ms = 0.0;     // time spent generating tokens
+    int n_drafted = 0;          // tokens proposed by the draft model
+    int n_draft_accepted = 0;   // drafted tokens confirmed by the target model
+    bool cancelled = false;     // the sink stopped the prompt evaluation early
+    int n_discarded_tokens = 0; // tokens dropped by context shifting / prompt truncation
+    int n_images = 0;           // images in a generate_multimodal() prompt
+    int n_image_cache_hits = 0; // images whose embeddings came from the on-disk cache
+    
+    double draft_acceptance_rate() const {
+        return n_drafted > 0 ? static_cast<double>(n_draft_accepted) / n_drafted : 0.0;
+    }
+};
+
+// How token embeddings are pooled into one vector per input
+enum class PoolingType {
+    Default,    // whatever the model's metadata specifies
+    Mean,
+    Cls,
+    Last,
+    Rank        // cross-encoder relevance score (reranker models)
+};
+
+// Row-major matrix with one pooled vector per input
+struct EmbeddingMatrix {
+    size_t rows = 0;
+    size_t dim = 0;
+    std::vector<float> data;    // rows * dim floats
+    
+    const float* row(size_t i) const { return data.data() + i * dim; }
+};
+
+// Relevance of one document to a query, as scored by a reranker model
+struct RerankResult {
+    size_t index = 0;           // position of the document in the input
+    float score = 0.0f;
+};
+
+// Outcome of one prompt processed by the multi-sequence scheduler
+struct BatchResult {
+    size_t index = 0;           // position of the prompt in the input
+    std::string text;
+    int n_prompt_tokens = 0;
+    int n_generated_tokens = 0;
+    bool ok = true;
+    std::string error;
+};
+
+// One generated token as delivered to a TokenSink. `piece` points into engine-owned
+// storage and is only valid for the duration of the callback. It only ever contains
+// complete UTF-8 characters, so it is empty when a token ends partway through one.
+struct TokenEvent {
+    int token = 0;
+    std::string_view piece;
+    float logprob = 0.0f;       // log-probability under the model (only if the sink wants_logprobs())
+    double t_ms = 0.0;          // milliseconds since the generate() call started
+    int index = 0;              // position of the token in the response
+};
+
+// Receives generated tokens as they are produced. Implementations must not throw.
+class TokenSink {
+public:
+    virtual ~TokenSink() = default;
+    virtual void on_token(const TokenEvent& event) = 0;
+    virtual void on_finish() {}
+    // Computing the log-probability costs a pass over the vocabulary per token
+    virtual bool wants_logprobs() const { return false; }
+    // Called after each prompt chunk is decoded. Return false to cancel the
+    // generation before the next chunk; the decoded part stays in the KV cache.
+    virtual bool on_prefill_progress(int n_done, int n_total, double tokens_per_sec) {
+        (void)n_done; (void)n_total; (void)tokens_per_sec;
+        return true;
+    }
+};
+
+// Writes each piece to stdout as soon as it arrives (interactive streaming)
+class TerminalTokenSink : public TokenSink {
+public:
+    void on_token(const TokenEvent& event) override;
+    void on_finish() override;
+    // Shows a progress line on stderr while long prompts are being evaluated
+    bool on_prefill_progress(int n_done, int n_total, double tokens_per_sec) override;
+    
+private:
+    bool progress_shown_ = false;
+};
+
+// Accumulates pieces and writes them to `out` in blocks of `flush_bytes`
+class BufferedTokenSink : public TokenSink {
+public:
+    explicit BufferedTokenSink(FILE* out = stdout, size_t flush_bytes = 4096);
+    ~BufferedTokenSink() override;
+    void on_token(const TokenEvent& event) override;
+    void on_finish() override;
+    
+private:
+    FILE* out_;
+    size_t flush_bytes_;
+    std::string buffer_;
+};
+
+// Collects the whole response into a string
+class StringTokenSink : public TokenSink {
+public:
+    void on_token(const TokenEvent& event) override { text_.append(event.piece.data(), event.piece.size()); }
+    const std::string& text() const { return text_; }
+    std::string take() { return std::move(text_); }
+    
+private:
+    std::string text_;
+};
+
+// Joins token pieces into valid UTF-8 text. A multi-byte character split across
+// several tokens is held back until its last byte arrives instead of being emitted
+// as broken bytes.
+class IncrementalDetokenizer {
+public:
+    // Append a piece and return the text that is now complete (may be empty).
+    // The view is valid until the next call.
+    std::string_view push(std::string_view piece);
+    // Bytes still held back at the end of the stream (an incomplete character)
+    std::string_view flush();
+    void reset();
+    
+private:
+    std::string buffer_;
+    size_t n_emitted_ = 0;      // bytes at the front of buffer_ already returned
+};
+
+// Detects generation stuck in a loop: a block of tokens repeated back to back.
+// Uses a rolling hash over token ids and a fixed-size table of where each n-gram
+// was last seen, so push() is O(1) (amortized) and never allocates once configured.
+// Blocks that recur with other text in between (code, lists) do not count.
+class RepetitionDetector {
+public:
+    // Trigger once a block of at least `ngram` tokens, whose copies start at most
+    // `window` tokens apart, has been repeated `max_repeats` times in a row.
+    // ngram <= 0 disables detection.
+    void configure(int ngram, int max_repeats, int window);
+    void reset();
+    // Add the next token; true if the output now ends in such a loop
+    bool push(int token);
+    
+private:
+    void rebuild_table();
+    size_t find_slot(uint64_t key) const;
+    
+    int ngram_ = 0;
+    int max_repeats_ = 0;
+    size_t window_ = 0;
+    uint64_t base_pow_ = 1;         // kBase^ngram_, removes the outgoing token from the hash
+    uint64_t hash_ = 0;
+    size_t n_pushed_ = 0;
+    size_t n_since_rebuild_ = 0;
+    size_t period_ = 0;             // distance to the previous copy of the current loop (0 = none)
+    size_t run_ = 0;                // consecutive n-grams equal to the one `period_` back
+    std::vector<int> tokens_;       // ring of the last ngram_ tokens
+    std::vector<uint64_t> hashes_;  // ring of the last window_ n-gram hashes
+    std::vector<uint64_t> keys_;    // open-addressing table, 0 = empty slot
+    std::vector<size_t> last_;      // n-gram index where each key was last seen
+};
+
+// The heuristic stops of the generation loop: the first sentence end once enough
+// tokens are out, and runaway repetition. Constrained output (a grammar or JSON
+// schema) skips both and runs until the grammar completes, as a cut would leave
+// it unparseable.
+class EarlyStop {
+public:
+    void configure(const InferenceConfig& config);
+    // Start a new response; `constrained` turns the heuristics off for it
+    void reset(bool constrained);
+    // Add the next token and its text; true if generation should stop after it
+    bool push(int token, std::string_view piece);
+    
+private:
+    int sentence_stop_tokens_ = 0;
+    int n_pushed_ = 0;
+    bool constrained_ = false;
+    RepetitionDetector repetition_;
+};
+
+struct GenerationScratch;
+class InferenceEngine;
+
+// A generation running on a background thread, started by InferenceEngine::generate_async().
+// Pieces can be consumed while they are produced; the whole response arrives through
+// result(). Destroying the handle cancels the generation and waits for it to stop.
+class GenerationHandle {
+public:
+    struct State;   // shared with the generating thread
+    
+    GenerationHandle() = default;
+    GenerationHandle(GenerationHandle&& other) noexcept = default;
+    GenerationHandle& operator=(GenerationHandle&& other) noexcept;
+    ~GenerationHandle();
+    GenerationHandle(const GenerationHandle&) = delete;
+    GenerationHandle& operator=(const GenerationHandle&) = delete;
+    
+    // Wait for the next piece of text. Returns false once the generation has
+    // finished and every piece has been consumed.
+    bool next_piece(std::string& piece);
+    
+    // Stop at the next decode step. The text produced so far is still delivered.
+    void cancel();
+    
+    // The full response; rethrows if the generation failed
+    std::future<std::string>& result() { return result_; }
+    
+    bool valid() const { return state_ != nullptr; }
+    
+private:
+    friend class InferenceEngine;
+    InferenceEngine* engine_ = nullptr;
+    std::shared_ptr<State> state_;
+    std::future<std::string> result_;
+    
+    void stop();
+};
+
+// Loaded model weights. Shared by reference count between every engine (context)
+// that uses them, so the weights are freed when the last engine lets go.
+class ModelHandle {
+public:
+    // Load config.model_path (or `path`) with the config's mmap/mlock/GPU settings.
+    // Returns nullptr if the file cannot be loaded.
+    static std::shared_ptr<ModelHandle> load(const std::string& path, const InferenceConfig& config);
+    ~ModelHandle();
+    ModelHandle(const ModelHandle&) = delete;
+    ModelHandle& operator=(const ModelHandle&) = delete;
+    
+    llama_model* get() const { return model_; }
+    const std::string& path() const { return path_; }
+    // tools::Hash::file_fingerprint() of the model file
+    const std::string& fingerprint() const { return fingerprint_; }
+    
+private:
+    ModelHandle();
+    llama_model* model_ = nullptr;
+    std::string path_;
+    std::string fingerprint_;
 };
 
 class InferenceEngine {
@@ -264,6 +767,15 @@ public:
     // Load model with configuration
     bool load_model(const InferenceConfig& config);
     
+    // Create a context for an already loaded model (and optional draft model) instead
+    // of loading the weights again. config.model_path is ignored.
+    bool load_model(std::shared_ptr<ModelHandle> model,
+                    const InferenceConfig& config,
+                    std::shared_ptr<ModelHandle> draft_model = nullptr);
+    
+    // The loaded model, for sharing with other engines
+    std::shared_ptr<ModelHandle> get_model() const { return model_handle_; }
+    
     // Unload current model
     void unload_model();
     
@@ -275,11 +787,66 @@ public:
                         int max_tokens = 512,
                         bool stream = true);
     
-    // Generate with multimodal input (text + images)
+    // Generate and deliver every token to `sink` as it is produced
+    void generate(const std::string& prompt, int max_tokens, TokenSink& sink);
+    
+    // Start generating on a background thread and return at once. The engine must
+    // not be used for anything else until the generation has finished.
+    GenerationHandle generate_async(const std::string& prompt, int max_tokens = 512);
+    
+    // Constrain the output of later generate() / generate_batch() calls to a GBNF
+    // grammar or to JSON matching a schema. Parsed grammars are cached by content,
+    // so switching back to one costs no parsing. An empty string removes the
+    // constraint. Returns false (keeping the previous constraint) if it does not parse.
+    bool set_grammar(const std::string& grammar);
+    bool set_json_schema(const std::string& schema);
+    
+    // Stop the running generation at the next decode step, or inside the current
+    // one on backends that can abort a graph. Safe to call from another thread or
+    // from a signal handler.
+    void cancel() { cancel_requested_.store(true); }
+    
+    // Generate responses for several prompts together. Up to n_parallel prompts are
+    // packed into one llama_batch with distinct sequence ids; each sequence retires
+    // independently on end-of-generation and its slot is refilled with the next prompt.
+    // Results are returned in input order.
+    std::vector<std::string> generate_batch(const std::vector<std::string>& prompts,
+                                            int max_tokens = 512);
+    
+    // Streaming form of generate_batch() for inputs too large to hold in memory.
+    // next_prompt() is called whenever a sequence slot frees up and returns false
+    // once the input is exhausted; on_result() receives each result as soon as its
+    // sequence retires, so results arrive in completion order, not input order.
+    void generate_batch(const std::function<bool(size_t& index, std::vector<int>& tokens)>& next_prompt,
+                        const std::function<void(BatchResult&& result)>& on_result,
+                        int max_tokens = 512);
+    
+    // Generate with multimodal input (text + images). Each image is encoded by the
+    // projector in config.mmproj_path; the encoded embeddings are cached on disk by
+    // image content, so asking about the same image again skips the vision encoder.
+    // Images go where the prompt has media markers, or in front of the text if none.
     std::string generate_multimodal(const std::string& prompt,
                                     const std::vector<std::string>& image_paths,
                                     int max_tokens = 512,
                                     bool stream = true);
+    void generate_multimodal(const std::string& prompt,
+                             const std::vector<std::string>& image_paths,
+                             int max_tokens,
+                             TokenSink& sink);
+    
+    // Embed many texts in packed multi-sequence batches on a dedicated embeddings
+    // context (created on first use). Throws if an input is longer than that context,
+    // rather than embedding a truncated prefix. With `normalize`, every row is scaled
+    // to unit L2 norm.
+    EmbeddingMatrix embed(const std::vector<std::string>& texts,
+                          PoolingType pooling = PoolingType::Default,
+                          bool normalize = true);
+    
+    // Score every (query, document) pair with a cross-encoder reranker model. All
+    // pairs are evaluated together in packed multi-sequence batches. Results are
+    // sorted by descending score. Throws if a pair is longer than the context.
+    std::vector<RerankResult> rerank(const std::string& query,
+                                     const std::vector<std::string>& documents);
     
     // Get model info
     std::string get_model_name() const;
@@ -289,19 +856,206 @@ public:
     // Tokenize text
     std::vector<int> tokenize(const std::string& text, bool add_bos = true);
     
+    // Render a conversation with the model's chat template, leaving the assistant's
+    // turn open. Earlier turns render the same way every time, so consecutive prompts
+    // of one conversation share their prefix (and KV cache). Empty if the model has no
+    // template llama.cpp can apply.
+    std::string format_chat(const std::vector<ChatMessage>& messages);
+    
     // Detokenize
     std::string detokenize(const std::vector<int>& tokens);
     
+    // Drop the KV cache so the next generate() re-decodes its whole prompt
+    void reset_cache();
+    
+    // Statistics for the last generate() call
+    const GenerationStats& get_last_stats() const { return last_stats_; }
+    
+    // Write the KV cache of the current conversation to <dir>/kv-<model fingerprint>.bin
+    bool save_session_state(const std::string& dir);
+    
+    // Restore a snapshot written by save_session_state() for the same model file, so
+    // the next generate() only decodes what was added since. False if none matches.
+    bool load_session_state(const std::string& dir);
+    
+    // Tokens currently held in the KV cache
+    size_t get_cached_token_count() const { return cached_tokens_.size(); }
+    
+    // True when a draft model is loaded and generate() decodes speculatively
+    bool has_draft_model() const { return draft_ctx_ != nullptr; }
+    
+    // True when a vision projector is loaded for generate_multimodal()
+    bool has_vision() const { return mtmd_ctx_ != nullptr; }
+    
+    // Time spent warming the model up in the last load_model() (0 if disabled)
+    double get_warmup_ms() const { return warmup_ms_; }
+    
 private:
-    llama_model* model_;
+    std::shared_ptr<ModelHandle> model_handle_;
+    llama_model* model_;                // model_handle_->get()
     llama_context* ctx_;
     llama_sampler* sampler_;
     InferenceConfig config_;
+    std::string model_fingerprint_;     // tools::Hash::file_fingerprint() of the model file
+    
+    // Optional draft model for speculative decoding; its KV cache mirrors
+    // draft_cached_tokens_ the same way ctx_ mirrors cached_tokens_.
+    std::shared_ptr<ModelHandle> draft_model_handle_;
+    llama_model* draft_model_ = nullptr;
+    llama_context* draft_ctx_ = nullptr;
+    std::vector<int> draft_cached_tokens_;
+    
+    // Tokens currently resident in the KV cache for sequence 0, in position order.
+    // Used to find the longest common prefix with the next prompt so only the
+    // divergent tail has to be decoded again.
+    std::vector<int> cached_tokens_;
+    GenerationStats last_stats_;
+    double warmup_ms_ = 0.0;
+    
+    // Parsed grammar samplers keyed by a hash of their source. Entries are never used
+    // directly: each generation works on a clone, which is far cheaper than parsing.
+    struct CachedGrammar {
+        llama_sampler* sampler = nullptr;
+        uint64_t last_used = 0;
+    };
+    std::map<uint64_t, CachedGrammar> grammar_cache_;
+    uint64_t grammar_clock_ = 0;
+    llama_sampler* grammar_proto_ = nullptr;   // active constraint (owned by grammar_cache_)
+    llama_sampler* grammar_ = nullptr;         // clone advanced by the current generation
+    
+    // Set by cancel(); polled between decode steps and by llama.cpp's abort callback
+    std::atomic<bool> cancel_requested_{false};
+    
+    // Context with embeddings enabled, used by embed(); recreated if the pooling changes
+    llama_context* pooled_ctx_ = nullptr;
+    PoolingType pooled_type_ = PoolingType::Default;
+    
+    // Vision projector (libmtmd) and the fingerprint that keys its embedding cache
+    mtmd_context* mtmd_ctx_ = nullptr;
+    std::string mmproj_fingerprint_;
+    
+    // Buffers reused by every generate() call so the token loop does not allocate
+    std::unique_ptr<GenerationScratch> scratch_;
+    
+    // Text of every vocabulary token, built once per model: token t is
+    // piece_arena_[piece_offsets_[t], piece_offsets_[t + 1])
+    std::vector<uint32_t> piece_offsets_;
+    std::string piece_arena_;
     
     void setup_sampler();
-    std::string generate_internal(const std::vector<int>& tokens, 
-                                  int max_tokens, 
-                                  bool stream);
+    // Cached or newly parsed grammar sampler for `key`; `make_grammar` supplies the
+    // GBNF source on a cache miss. Null if it fails to parse.
+    llama_sampler* cached_grammar(uint64_t key, const std::function<std::string()>& make_grammar);
+    // Start the active grammar (if any) from its root for a new response
+    void reset_grammar();
+    void free_grammars();
+    std::string session_state_path(const std::string& dir) const;
+    // Free room for n_needed tokens by discarding old context (config_.context_shift)
+    bool shift_context(int n_needed);
+    // Drop KV cells past cached_tokens_ left behind by a decode that cancel() aborted
+    void discard_aborted_decode();
+    // Multi-sequence scheduler behind generate_batch(). next_prompt() is polled
+    // whenever a slot is free and returns false once the input is exhausted.
+    void run_sequences(const std::function<bool(size_t& index, std::vector<int>& tokens)>& next_prompt,
+                       const std::function<void(BatchResult&& result)>& on_result,
+                       int max_tokens);
+    void generate_internal(const std::vector<int>& tokens, 
+                           int max_tokens, 
+                           TokenSink& sink);
+    // Sample and decode up to max_tokens after the prompt has been evaluated
+    void generate_tokens(int max_tokens,
+                         TokenSink& sink,
+                         std::chrono::steady_clock::time_point t_start,
+                         bool speculative);
+    void build_piece_table();
+    llama_context* pooled_context(PoolingType pooling);
+    std::vector<int> rerank_tokens(const std::string& query, const std::string& document);
+    // Evaluate token sequences in packed batches on pooled_context() and copy each
+    // sequence's pooled output (n_out floats) to out + i * n_out
+    void run_pooled(llama_context* ctx, const std::vector<std::vector<int>>& inputs, int n_out, float* out);
+    // Look up a token in the piece table; false for ids outside the vocabulary
+    bool token_to_piece(int token, std::string_view& piece) const;
+    
+    // Use `draft` if given, otherwise load config_.draft_model_path
+    bool load_draft_model(std::shared_ptr<ModelHandle> draft);
+    void unload_draft_model();
+    bool load_projector();
+    std::string image_cache_path(uint64_t image_hash) const;
+    // Encoder output for an image chunk, from the cache or by running the projector
+    bool encode_image(const mtmd_input_chunk* chunk, uint64_t image_hash, std::vector<float>& embd);
+    // Greedily propose up to n_max tokens that follow cached_tokens_ + id_last
+    void draft_tokens(int id_last, int n_max, std::vector<int>& draft);
+    // Propose up to n_max tokens by finding the most recent earlier occurrence of the
+    // trailing n-gram of cached_tokens_ + id_last and copying what followed it
+    void lookup_draft(int id_last, int n_max, std::vector<int>& draft) const;
+    // Decode id_last + draft in one target batch and sample at every position.
+    // Fills `accepted` with the accepted draft prefix followed by one token sampled
+    // by the target; rejected positions are removed from the KV cache.
+    // Returns false if the batch could not be decoded.
+    bool verify_draft(int id_last, const std::vector<int>& draft, std::vector<int>& accepted);
+};
+
+// Independent sessions over one copy of the weights. Every engine in the pool has its
+// own context, sampler and KV cache bound to the same ModelHandle, so each extra
+// session costs its KV cache rather than another copy of the model.
+// Engines are created on first demand, up to max_engines. The pool must outlive its leases.
+class EnginePool {
+public:
+    // Exclusive use of one engine; returned to the pool when the lease goes away
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        ~Lease() { release(); }
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        
+        InferenceEngine* operator->() const { return engine_; }
+        InferenceEngine& operator*() const { return *engine_; }
+        explicit operator bool() const { return engine_ != nullptr; }
+        void release();
+        
+    private:
+        friend class EnginePool;
+        Lease(EnginePool* pool, InferenceEngine* engine) : pool_(pool), engine_(engine) {}
+        EnginePool* pool_ = nullptr;
+        InferenceEngine* engine_ = nullptr;
+    };
+    
+    EnginePool() = default;
+    ~EnginePool();
+    EnginePool(const EnginePool&) = delete;
+    EnginePool& operator=(const EnginePool&) = delete;
+    
+    // Load the model (and draft model, if configured) once. Returns false on failure.
+    bool load(const InferenceConfig& config, size_t max_engines);
+    
+    // Wait for a free engine, creating one if below max_engines.
+    // Throws std::runtime_error if the pool is not loaded or a context cannot be created.
+    Lease acquire();
+    
+    // Like acquire(), but returns an empty lease instead of waiting
+    Lease try_acquire();
+    
+    std::shared_ptr<ModelHandle> model() const { return model_; }
+    size_t size() const;            // engines created so far
+    size_t capacity() const { return max_engines_; }
+    
+private:
+    InferenceConfig config_;
+    std::shared_ptr<ModelHandle> model_;
+    std::shared_ptr<ModelHandle> draft_model_;
+    size_t max_engines_ = 0;
+    
+    mutable std::mutex mutex_;
+    std::condition_variable available_;
+    std::vector<std::unique_ptr<InferenceEngine>> engines_;
+    std::vector<InferenceEngine*> idle_;
+    size_t n_creating_ = 0;         // engines being created outside the lock
+    
+    Lease take(bool wait);
+    void give_back(InferenceEngine* engine);
 };
 
 // ============================================================================
@@ -337,11 +1091,82 @@ public:
     static std::string first_gguf_in_dir(const std::string& path);
     /** Resolve path to absolute so llama-server can find the model regardless of cwd. Returns empty if path is empty or resolution fails. */
     static std::string absolute_path(const std::string& path);
+    /** Ask the OS to start reading the whole file into the page cache (madvise/fadvise WILLNEED). Returns false if unsupported or unreadable. */
+    static bool prefetch_file(const std::string& path);
     static std::string get_home_dir();
     static std::string join_path(const std::string& a, const std::string& b);
     static std::string get_executable_dir();
 };
 
+// Hashing helpers for cache keys (not cryptographic)
+class Hash {
+public:
+    static uint64_t fnv1a64(const void* data, size_t size, uint64_t seed = 14695981039346656037ULL);
+    static std::string to_hex(uint64_t value);
+    /** Fingerprint of a (large) file from its size and first/last MiB. Returns "" if unreadable. */
+    static std::string file_fingerprint(const std::string& path);
+};
+
+// Incremental SHA-256, fed as download data arrives so verification needs no second pass
+class Sha256 {
+public:
+    Sha256();
+    void update(const void* data, size_t size);
+    /** Lowercase hex digest of everything fed so far (the hash can keep being updated). */
+    std::string hex_digest() const;
+    uint64_t bytes() const { return length_; }
+    /** Midstate as text, so an interrupted download can continue hashing where it stopped. */
+    std::string save_state() const;
+    bool load_state(const std::string& state);
+    
+private:
+    void transform(const unsigned char* block);
+    
+    uint32_t h_[8];
+    unsigned char buffer_[64];
+    size_t buffer_len_ = 0;
+    uint64_t length_ = 0;
+};
+
+// Host hardware detection
+class SystemInfo {
+public:
+    struct CpuTopology {
+        int logical_cores = 1;
+        int physical_cores = 1;
+        int numa_nodes = 1;
+    };
+    
+    /** Detected once (Linux: /sys and the affinity mask, macOS: sysctl, Windows: GetLogicalProcessorInformation). */
+    static const CpuTopology& cpu_topology();
+    /** Decode is memory-bound, so SMT siblings only contend: one thread per physical core. */
+    static int default_threads();
+    /** Prompt processing is compute-bound and benefits from SMT: one thread per logical core. */
+    static int default_threads_batch();
+    
+    static const char* numa_strategy_name(NumaStrategy strategy);
+    static bool parse_numa_strategy(const std::string& name, NumaStrategy& strategy);
+    /** " --threads N --threads-batch M [--numa S]" for llama-server; values <= 0 use the defaults above. */
+    static std::string llama_server_thread_args(int n_threads, int n_threads_batch, NumaStrategy numa);
+};
+
+// llama-server command line options that vary between builds
+class ServerFlags {
+public:
+    /** True if `server_bin --help` lists the option. The help text is read once per binary. */
+    static bool supports(const std::string& server_bin, const std::string& flag);
+    
+    static const char* kv_cache_type_name(KvCacheType type);
+    static bool parse_kv_cache_type(const std::string& name, KvCacheType& type);
+    static const char* flash_attn_name(FlashAttention mode);
+    static bool parse_flash_attn(const std::string& name, FlashAttention& mode);
+    
+    /** " --flash-attn X --cache-type-k Y --cache-type-v Z" for server_bin, leaving out defaults and
+     *  options it does not support. A quantized V cache forces flash attention on, or falls back to f16. */
+    static std::string kv_cache_args(const std::string& server_bin, KvCacheType type_k, KvCacheType type_v,
+                                     FlashAttention flash_attn);
+};
+
 // Shell integration
 class Shell {
 public:
@@ -5,6 +5,7 @@
 
 #include "delta_cli.h"
 #include "model_api_server.h"
+#include <cpp-httplib/httplib.h>
 #include <iostream>
 #include <iomanip>
 #include <cstdio>
@@ -12,6 +13,7 @@
 #include <string>
 #include <vector>
 #include <cstdlib>
+#include <cerrno>
 #include <filesystem>
 #include <limits.h>
 #include <cctype>
@@ -93,6 +95,13 @@ class DeltaServerWrapper {
     bool enable_reranking_;
     std::string draft_model_;
     std::string grammar_file_;
+    int n_threads_;
+    int n_threads_batch_;
+    delta::NumaStrategy numa_;
+    delta::KvCacheType kv_type_k_;
+    delta::KvCacheType kv_type_v_;
+    delta::FlashAttention flash_attn_;
+    bool warmup_;
 
     // Process management for delta-server
     std::thread llama_server_thread_;
@@ -110,7 +119,9 @@ class DeltaServerWrapper {
   public:
     DeltaServerWrapper()
         : port_(8080), model_api_port_(8081), max_parallel_(4), max_context_(0), enable_embedding_(false),
-          enable_reranking_(false), llama_server_running_(false), should_stop_(false)
+          enable_reranking_(false), n_threads_(0), n_threads_batch_(0), numa_(delta::NumaStrategy::Disabled),
+          kv_type_k_(delta::KvCacheType::F16), kv_type_v_(delta::KvCacheType::F16),
+          flash_attn_(delta::FlashAttention::Auto), warmup_(true), llama_server_running_(false), should_stop_(false)
 #ifdef _WIN32
           ,
           llama_server_process_(NULL), llama_server_pid_(0), job_object_(NULL)
@@ -264,6 +275,22 @@ class DeltaServerWrapper {
 
     void set_grammar_file(const std::string& file) { grammar_file_ = file; }
 
+    // 0 = pick from the detected CPU topology
+    void set_threads(int n_threads, int n_threads_batch) {
+        n_threads_ = n_threads;
+        n_threads_batch_ = n_threads_batch;
+    }
+
+    void set_numa(delta::NumaStrategy numa) { numa_ = numa; }
+
+    void set_warmup(bool enabled) { warmup_ = enabled; }
+
+    void set_kv_cache(delta::KvCacheType type_k, delta::KvCacheType type_v, delta::FlashAttention flash_attn) {
+        kv_type_k_ = type_k;
+        kv_type_v_ = type_v;
+        flash_attn_ = flash_attn;
+    }
+
     std::string find_webui_path() {
         // Find the Delta web UI directory (from public/ only, not llama.cpp web UI)
         std::vector<std::string> candidates;
@@ -401,6 +428,12 @@ class DeltaServerWrapper {
 #endif
         if (!model_path.empty()) {
             cmd += " -m \"" + model_path + "\"";
+            // Serve image input for vision models whose projector was pulled alongside
+            std::string mmproj = delta::ModelManager::get_mmproj_path(model_path);
+            if (delta::tools::FileOps::file_exists(mmproj) &&
+                delta::tools::ServerFlags::supports(llama_server_path_, "--mmproj")) {
+                cmd += " --mmproj \"" + mmproj + "\"";
+            }
         } else if (!models_dir_.empty()) {
             std::string dir_arg = delta::tools::FileOps::absolute_path(models_dir_);
             if (dir_arg.empty())
@@ -412,7 +445,12 @@ class DeltaServerWrapper {
         if (ctx_size > 0) {
             cmd += " -c " + std::to_string(ctx_size);
         }
-        // Minimal flags for compatibility; avoid --flash-attn/--jinja which some builds don't support
+        cmd += delta::tools::SystemInfo::llama_server_thread_args(n_threads_, n_threads_batch_, numa_);
+        if (!warmup_ && delta::tools::ServerFlags::supports(llama_server_path_, "--no-warmup")) {
+            cmd += " --no-warmup";
+        }
+        // Build-dependent flags are only passed when `llama-server --help` lists them
+        cmd += delta::tools::ServerFlags::kv_cache_args(llama_server_path_, kv_type_k_, kv_type_v_, flash_attn_);
         if (ctx_size > 16384) {
             cmd += " --gpu-layers 0";
         }
@@ -481,6 +519,38 @@ class DeltaServerWrapper {
         stop_llama_server_locked();
     }
 
+    // llama-server opens its port before the model has finished loading. Wait for
+    // /health and push one token through so the first user request after a model
+    // switch does not pay for loading or page faults.
+    void warm_up_llama_server() {
+        auto start = std::chrono::steady_clock::now();
+        httplib::Client client("127.0.0.1", port_);
+        client.set_connection_timeout(1, 0);
+        client.set_read_timeout(120, 0);
+
+        bool healthy = false;
+        for (int attempt = 0; attempt < 600 && !should_stop_; ++attempt) {
+            auto res = client.Get("/health");
+            if (res && res->status == 200) {
+                healthy = true;
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        }
+        if (!healthy) {
+            return;
+        }
+
+        // Router mode has no default model to send the request to
+        if (models_dir_.empty()) {
+            client.Post("/completion", R"({"prompt":"Hi","n_predict":1,"cache_prompt":false})",
+                        "application/json");
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Model warm (" << std::fixed << std::setprecision(1) << seconds << "s)" << std::endl;
+    }
+
     bool restart_llama_server(const std::string& new_model_path, const std::string& model_name, int ctx_size,
                               const std::string& model_alias) {
         std::lock_guard<std::mutex> lock(llama_server_mutex_);
@@ -545,6 +615,11 @@ class DeltaServerWrapper {
         model_path_ = new_model_path;
         max_context_ = ctx_size;
 
+        // Let the OS read the weights while llama-server starts up
+        if (warmup_ && !new_model_path.empty()) {
+            delta::tools::FileOps::prefetch_file(new_model_path);
+        }
+
         // Build new command
         std::string cmd = build_llama_server_command(new_model_path, ctx_size, model_alias);
 
@@ -599,6 +674,9 @@ class DeltaServerWrapper {
 
             if (port_ok) {
                 std::cout << "Server ready" << std::endl;
+                if (warmup_) {
+                    warm_up_llama_server();
+                }
                 return true;
             }
             DWORD exit_code;
@@ -717,6 +795,9 @@ class DeltaServerWrapper {
 
             if (port_ok) {
                 std::cout << "Server ready" << std::endl;
+                if (warmup_) {
+                    warm_up_llama_server();
+                }
                 return true;
             }
 
@@ -875,6 +956,18 @@ class DeltaServerWrapper {
 
 } // namespace delta
 
+// Thread count from the command line; 0 keeps the automatic default
+static bool parse_thread_count(const std::string& value, int& count) {
+    char* end = nullptr;
+    errno = 0;
+    long parsed = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || errno == ERANGE || parsed < 0 || parsed > INT_MAX) {
+        return false;
+    }
+    count = static_cast<int>(parsed);
+    return true;
+}
+
 int main(int argc, char* argv[]) {
     delta::DeltaServerWrapper wrapper;
 
@@ -888,6 +981,13 @@ int main(int argc, char* argv[]) {
     bool enable_reranking = false;
     std::string draft_model;
     std::string grammar_file;
+    int n_threads = 0;
+    int n_threads_batch = 0;
+    delta::NumaStrategy numa = delta::NumaStrategy::Disabled;
+    bool warmup = true;
+    delta::KvCacheType kv_type_k = delta::KvCacheType::F16;
+    delta::KvCacheType kv_type_v = delta::KvCacheType::F16;
+    delta::FlashAttention flash_attn = delta::FlashAttention::Auto;
 
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -911,6 +1011,38 @@ int main(int argc, char* argv[]) {
             draft_model = argv[++i];
         } else if (arg == "--grammar-file" && i + 1 < argc) {
             grammar_file = argv[++i];
+        } else if ((arg == "--threads" || arg == "-t" || arg == "--threads-batch" || arg == "-tb") && i + 1 < argc) {
+            std::string value = argv[++i];
+            int& count = (arg == "--threads" || arg == "-t") ? n_threads : n_threads_batch;
+            if (!parse_thread_count(value, count)) {
+                std::cerr << "Error: invalid thread count for " << arg << ": " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--numa" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (!delta::tools::SystemInfo::parse_numa_strategy(mode, numa)) {
+                std::cerr << "Error: unknown NUMA strategy: " << mode << std::endl;
+                std::cerr << "Use one of: distribute, isolate, numactl, off" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--no-warmup") {
+            warmup = false;
+        } else if ((arg == "--cache-type-k" || arg == "-ctk" || arg == "--cache-type-v" || arg == "-ctv") &&
+                   i + 1 < argc) {
+            std::string type = argv[++i];
+            delta::KvCacheType& kv_type = (arg == "--cache-type-k" || arg == "-ctk") ? kv_type_k : kv_type_v;
+            if (!delta::tools::ServerFlags::parse_kv_cache_type(type, kv_type)) {
+                std::cerr << "Error: unknown KV cache type: " << type << std::endl;
+                std::cerr << "Use one of: f16, q8_0, q4_0" << std::endl;
+                return 1;
+            }
+        } else if ((arg == "--flash-attn" || arg == "-fa") && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (!delta::tools::ServerFlags::parse_flash_attn(mode, flash_attn)) {
+                std::cerr << "Error: unknown flash attention mode: " << mode << std::endl;
+                std::cerr << "Use one of: on, off, auto" << std::endl;
+                return 1;
+            }
         }
     }
 
@@ -924,6 +1056,10 @@ int main(int argc, char* argv[]) {
     wrapper.set_reranking(enable_reranking);
     wrapper.set_draft_model(draft_model);
     wrapper.set_grammar_file(grammar_file);
+    wrapper.set_threads(n_threads, n_threads_batch);
+    wrapper.set_numa(numa);
+    wrapper.set_warmup(warmup);
+    wrapper.set_kv_cache(kv_type_k, kv_type_v, flash_attn);
 
     return wrapper.start_server();
 }
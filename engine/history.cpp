@@ -952,6 +952,10 @@ std::string HistoryManager::get_current_session_name() const {
     return current_session_.empty() ? "default" : current_session_;
 }
 
+std::string HistoryManager::get_session_dir() const {
+    return tools::FileOps::join_path(history_dir_, get_current_session_name());
+}
+
 std::string HistoryManager::get_session_info() const {
     std::ostringstream info;
     
@@ -93,6 +93,7 @@ public:
     bool enforce_default_session();  // Always enforce default session usage
     bool is_default_session_active() const;
     std::string get_current_session_name() const;
+    std::string get_session_dir() const;  // ~/.delta-cli/history/<session>
     
     // Session info and status
     std::string get_session_info() const;  // Get formatted session information
@@ -9,9 +9,18 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 
 // Modern llama.cpp headers
 #include "llama.h"
+#include "mtmd.h"
+#include "mtmd-helper.h"
+#include "json-schema-to-grammar.h"
+#include <nlohmann/json.hpp>
 #include <limits>
 
 namespace delta {
@@ -26,42 +35,277 @@ static void llama_log_callback(enum ggml_log_level level, const char* text, void
     }
 }
 
-// Helper function to convert token to string (from run.cpp)
-static int convert_token_to_string(const llama_vocab* vocab, const llama_token token_id, std::string& piece) {
-    char buf[256];
-    int n = llama_token_to_piece(vocab, token_id, buf, sizeof(buf), 0, true);
-    if (n < 0) {
-        return 1;
+// Log-probability of `token` under the raw logits (log-softmax over the vocabulary)
+static float token_logprob(const float* logits, int n_vocab, llama_token token) {
+    float max_logit = logits[0];
+    for (int i = 1; i < n_vocab; i++) {
+        max_logit = std::max(max_logit, logits[i]);
+    }
+    double sum = 0.0;
+    for (int i = 0; i < n_vocab; i++) {
+        sum += std::exp(static_cast<double>(logits[i] - max_logit));
+    }
+    return static_cast<float>(logits[token] - max_logit - std::log(sum));
+}
+
+// Single-line prompt progress on stderr. Only shown for prompts that take more than one
+// chunk, and erased once the whole prompt is in so the response starts on a clean line.
+static void print_prefill_progress(int n_done, int n_total, double tokens_per_sec, bool& shown) {
+    if (n_done >= n_total) {
+        if (shown) {
+            fprintf(stderr, "\r%60s\r", "");
+            fflush(stderr);
+            shown = false;
+        }
+        return;
     }
-    piece = std::string(buf, n);
-    return 0;
+    fprintf(stderr, "\rProcessing prompt: %d/%d tokens (%.0f tok/s)", n_done, n_total, tokens_per_sec);
+    fflush(stderr);
+    shown = true;
 }
 
-// Helper function to print and concatenate response (from run.cpp)
-static void print_word_and_concatenate_to_response(const std::string& piece, std::string& response) {
-    printf("%s", piece.c_str());
+// Streams to the terminal and keeps the text, for the legacy generate(..., stream) API
+class EchoStringTokenSink : public StringTokenSink {
+public:
+    explicit EchoStringTokenSink(bool echo) : echo_(echo) {}
+    void on_token(const TokenEvent& event) override {
+        StringTokenSink::on_token(event);
+        if (echo_) {
+            fwrite(event.piece.data(), 1, event.piece.size(), stdout);
+            fflush(stdout);
+        }
+    }
+    bool on_prefill_progress(int n_done, int n_total, double tokens_per_sec) override {
+        if (echo_) {
+            print_prefill_progress(n_done, n_total, tokens_per_sec, progress_shown_);
+        }
+        return true;
+    }
+    
+private:
+    bool echo_;
+    bool progress_shown_ = false;
+};
+
+void TerminalTokenSink::on_token(const TokenEvent& event) {
+    fwrite(event.piece.data(), 1, event.piece.size(), stdout);
     fflush(stdout);
-    response += piece;
 }
 
+bool TerminalTokenSink::on_prefill_progress(int n_done, int n_total, double tokens_per_sec) {
+    print_prefill_progress(n_done, n_total, tokens_per_sec, progress_shown_);
+    return true;
+}
 
-InferenceEngine::InferenceEngine() 
-    : model_(nullptr), ctx_(nullptr), sampler_(nullptr) {
-    // Set custom log callback to suppress verbose output
-    llama_log_set(llama_log_callback, nullptr);
-    // Initialize llama.cpp backend
-    llama_backend_init();
+void TerminalTokenSink::on_finish() {
+    fflush(stdout);
 }
 
-InferenceEngine::~InferenceEngine() {
-    unload_model();
-    llama_backend_free();
+BufferedTokenSink::BufferedTokenSink(FILE* out, size_t flush_bytes)
+    : out_(out), flush_bytes_(std::max<size_t>(flush_bytes, 1)) {
+    buffer_.reserve(flush_bytes_ * 2);
 }
 
-bool InferenceEngine::load_model(const InferenceConfig& config) {
-    unload_model();
+BufferedTokenSink::~BufferedTokenSink() {
+    on_finish();
+}
+
+void BufferedTokenSink::on_token(const TokenEvent& event) {
+    buffer_.append(event.piece.data(), event.piece.size());
+    if (buffer_.size() >= flush_bytes_) {
+        fwrite(buffer_.data(), 1, buffer_.size(), out_);
+        buffer_.clear();
+    }
+}
+
+void BufferedTokenSink::on_finish() {
+    if (!buffer_.empty()) {
+        fwrite(buffer_.data(), 1, buffer_.size(), out_);
+        buffer_.clear();
+    }
+    fflush(out_);
+}
+
+// Pieces handed from the generating thread to a GenerationHandle
+struct GenerationHandle::State {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::string> pieces;
+    bool done = false;
+};
+
+// Feeds a GenerationHandle's queue and keeps the text for its future
+class QueueTokenSink : public StringTokenSink {
+public:
+    explicit QueueTokenSink(GenerationHandle::State& state) : state_(state) {}
+    void on_token(const TokenEvent& event) override {
+        StringTokenSink::on_token(event);
+        if (event.piece.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(state_.mutex);
+            state_.pieces.emplace_back(event.piece);
+        }
+        state_.ready.notify_one();
+    }
     
-    config_ = config;
+private:
+    GenerationHandle::State& state_;
+};
+
+// llama.cpp polls this between graph nodes, so cancel() also stops a long prefill chunk
+static bool abort_requested(void* data) {
+    return static_cast<const std::atomic<bool>*>(data)->load();
+}
+
+// Clears a pending cancel() once the generation it was aimed at has returned
+struct CancelScope {
+    explicit CancelScope(std::atomic<bool>& flag) : flag(flag) {}
+    ~CancelScope() { flag.store(false); }
+    std::atomic<bool>& flag;
+};
+
+// Length of the longest common prefix of the cached and the new token sequence
+static size_t common_prefix_length(const std::vector<int>& cached, const std::vector<llama_token>& tokens) {
+    size_t n = std::min(cached.size(), tokens.size());
+    size_t i = 0;
+    while (i < n && cached[i] == tokens[i]) {
+        i++;
+    }
+    return i;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// Per-engine buffers for the generation loop, sized once at load_model() so that
+// steady-state decoding does not touch the heap
+struct GenerationScratch {
+    IncrementalDetokenizer utf8;
+    EarlyStop early_stop;
+    std::vector<int> draft;
+    std::vector<int> accepted;
+    std::vector<llama_token_data> candidates;   // full-vocabulary logits for sampling
+    llama_batch batch;          // one sequence, `capacity` tokens
+    int32_t capacity;
+    
+    explicit GenerationScratch(int32_t n_batch) : batch(llama_batch_init(n_batch, 0, 1)), capacity(n_batch) {}
+    ~GenerationScratch() { llama_batch_free(batch); }
+    GenerationScratch(const GenerationScratch&) = delete;
+    GenerationScratch& operator=(const GenerationScratch&) = delete;
+};
+
+static void batch_add(llama_batch& batch, llama_token token, llama_pos pos, llama_seq_id seq_id, bool logits) {
+    batch.token[batch.n_tokens] = token;
+    batch.pos[batch.n_tokens] = pos;
+    batch.n_seq_id[batch.n_tokens] = 1;
+    batch.seq_id[batch.n_tokens][0] = seq_id;
+    batch.logits[batch.n_tokens] = logits;
+    batch.n_tokens++;
+}
+
+// Sample from `chain` at batch index `idx`, subject to `grammar` (may be null). As in
+// llama.cpp's common sampler, only the sampled token is checked against the grammar
+// first; the whole vocabulary is masked only when that token is rejected, which keeps
+// constrained decoding close to the speed of unconstrained decoding. Candidates are
+// built in `cur` rather than through llama_sampler_sample(), which allocates a
+// vocabulary-sized array per call. The token is accepted into both samplers here;
+// callers must not accept it again.
+static llama_token sample_constrained(llama_context* ctx, int32_t idx, llama_sampler* chain,
+                                      llama_sampler* grammar, std::vector<llama_token_data>& cur) {
+    const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(llama_get_model(ctx)));
+    const float* logits = llama_get_logits_ith(ctx, idx);
+    auto candidates = [&]() {
+        cur.resize(n_vocab);
+        for (int i = 0; i < n_vocab; i++) {
+            cur[i] = llama_token_data{i, logits[i], 0.0f};
+        }
+        return llama_token_data_array{cur.data(), cur.size(), -1, false};
+    };
+    
+    llama_token_data_array cur_p = candidates();
+    llama_sampler_apply(chain, &cur_p);
+    llama_token token = cur_p.data[cur_p.selected].id;
+    
+    if (grammar) {
+        llama_token_data single = {token, 1.0f, 0.0f};
+        llama_token_data_array single_p = {&single, 1, -1, false};
+        llama_sampler_apply(grammar, &single_p);
+        if (!std::isfinite(single.logit)) {
+            cur_p = candidates();
+            llama_sampler_apply(grammar, &cur_p);
+            llama_sampler_apply(chain, &cur_p);
+            token = cur_p.data[cur_p.selected].id;
+        }
+        llama_sampler_accept(grammar, token);
+    }
+    
+    llama_sampler_accept(chain, token);
+    return token;
+}
+
+// Upper bound on parsed grammars kept per engine
+static const size_t kMaxCachedGrammars = 16;
+
+// The llama.cpp backend is process-wide: initialize it with the first engine or
+// model and free it with the last one, however many are alive at once
+static std::mutex g_backend_mutex;
+static int g_backend_refs = 0;
+
+static void backend_acquire() {
+    std::lock_guard<std::mutex> lock(g_backend_mutex);
+    if (g_backend_refs++ == 0) {
+        // Set custom log callback to suppress verbose output
+        llama_log_set(llama_log_callback, nullptr);
+        llama_backend_init();
+    }
+}
+
+static void backend_release() {
+    std::lock_guard<std::mutex> lock(g_backend_mutex);
+    if (--g_backend_refs == 0) {
+        llama_backend_free();
+    }
+}
+
+// NUMA placement is process-wide in ggml and can only be chosen once
+static void init_numa(NumaStrategy strategy) {
+    static bool initialized = false;
+    if (initialized || strategy == NumaStrategy::Disabled) {
+        return;
+    }
+    switch (strategy) {
+        case NumaStrategy::Distribute: llama_numa_init(GGML_NUMA_STRATEGY_DISTRIBUTE); break;
+        case NumaStrategy::Isolate:    llama_numa_init(GGML_NUMA_STRATEGY_ISOLATE); break;
+        case NumaStrategy::Numactl:    llama_numa_init(GGML_NUMA_STRATEGY_NUMACTL); break;
+        default: break;
+    }
+    initialized = true;
+}
+
+ModelHandle::ModelHandle() {
+    backend_acquire();
+}
+
+ModelHandle::~ModelHandle() {
+    if (model_) {
+        llama_model_free(model_);
+    }
+    backend_release();
+}
+
+std::shared_ptr<ModelHandle> ModelHandle::load(const std::string& path, const InferenceConfig& config) {
+    std::shared_ptr<ModelHandle> handle(new ModelHandle());
+    init_numa(config.numa);
+    
+    // Start pulling the weights into the page cache before llama.cpp maps them,
+    // instead of faulting them in one page at a time during the first request
+    if (config.warmup && config.use_mmap) {
+        tools::FileOps::prefetch_file(path);
+    }
     
     // Set up model parameters
     llama_model_params model_params = llama_model_default_params();
@@ -69,52 +313,314 @@ bool InferenceEngine::load_model(const InferenceConfig& config) {
     model_params.use_mmap = config.use_mmap;
     model_params.use_mlock = config.use_mlock;
     
-    // Load model
-    model_ = llama_model_load_from_file(config.model_path.c_str(), model_params);
-    if (!model_) {
+    handle->model_ = llama_model_load_from_file(path.c_str(), model_params);
+    if (!handle->model_) {
+        return nullptr;
+    }
+    handle->path_ = path;
+    // Session snapshots are only valid for the exact model file they were taken with
+    handle->fingerprint_ = tools::Hash::file_fingerprint(path);
+    return handle;
+}
+
+InferenceEngine::InferenceEngine() 
+    : model_(nullptr), ctx_(nullptr), sampler_(nullptr) {
+    backend_acquire();
+}
+
+InferenceEngine::~InferenceEngine() {
+    unload_model();
+    backend_release();
+}
+
+static enum ggml_type to_ggml_type(KvCacheType type) {
+    switch (type) {
+        case KvCacheType::Q8_0: return GGML_TYPE_Q8_0;
+        case KvCacheType::Q4_0: return GGML_TYPE_Q4_0;
+        default:                return GGML_TYPE_F16;
+    }
+}
+
+static enum llama_flash_attn_type to_llama_flash_attn(FlashAttention mode) {
+    switch (mode) {
+        case FlashAttention::On:  return LLAMA_FLASH_ATTN_TYPE_ENABLED;
+        case FlashAttention::Off: return LLAMA_FLASH_ATTN_TYPE_DISABLED;
+        default:                  return LLAMA_FLASH_ATTN_TYPE_AUTO;
+    }
+}
+
+// Run one dummy token through the model so every weight is faulted in (and, with
+// llama_set_warmup, every MoE expert touched) before the first real request.
+// The KV cache and perf counters are left as if nothing had been decoded.
+static void warm_up_context(llama_context* ctx, const llama_model* model) {
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    llama_token token = llama_vocab_bos(vocab);
+    if (token == LLAMA_TOKEN_NULL) {
+        token = llama_vocab_eos(vocab);
+    }
+    if (token == LLAMA_TOKEN_NULL) {
+        token = 0;
+    }
+    
+    llama_set_warmup(ctx, true);
+    llama_decode(ctx, llama_batch_get_one(&token, 1));
+    llama_synchronize(ctx);
+    llama_set_warmup(ctx, false);
+    
+    llama_memory_clear(llama_get_memory(ctx), true);
+    llama_perf_context_reset(ctx);
+}
+
+bool InferenceEngine::load_model(const InferenceConfig& config) {
+    unload_model();
+    
+    std::shared_ptr<ModelHandle> model = ModelHandle::load(config.model_path, config);
+    if (!model) {
         UI::print_error("Failed to load model: " + config.model_path);
         return false;
     }
+    return load_model(model, config);
+}
+
+bool InferenceEngine::load_model(std::shared_ptr<ModelHandle> model,
+                                 const InferenceConfig& config,
+                                 std::shared_ptr<ModelHandle> draft_model) {
+    unload_model();
+    if (!model) {
+        return false;
+    }
+    
+    config_ = config;
+    config_.model_path = model->path();
+    // Resolve automatic thread counts from the detected CPU topology
+    if (config_.n_threads <= 0) {
+        config_.n_threads = tools::SystemInfo::default_threads();
+    }
+    if (config_.n_threads_batch <= 0) {
+        config_.n_threads_batch = tools::SystemInfo::default_threads_batch();
+    }
+    // A speculative step decodes the sampled token plus the draft in one batch
+    if (config_.n_draft > config_.n_batch - 1) {
+        config_.n_draft = std::max(0, config_.n_batch - 1);
+        if (draft_model || !config_.draft_model_path.empty() || config_.lookup_ngram > 0) {
+            UI::print_warning("Draft length limited to n_batch - 1 (" + std::to_string(config_.n_draft) + " tokens)");
+        }
+    }
+    cached_tokens_.clear();
+    last_stats_ = GenerationStats();
+    warmup_ms_ = 0.0;
+    model_handle_ = model;
+    model_ = model->get();
     
     // Set up context parameters
     llama_context_params ctx_params = llama_context_default_params();
     ctx_params.n_ctx = config.n_ctx;
     ctx_params.n_batch = config.n_batch;
-    ctx_params.n_threads = config.n_threads;
-    ctx_params.n_threads_batch = config.n_threads;
+    ctx_params.n_ubatch = std::min(config.n_ubatch, config.n_batch);
+    ctx_params.n_threads = config_.n_threads;
+    ctx_params.n_threads_batch = config_.n_threads_batch;
+    ctx_params.n_seq_max = std::max(1, config.n_parallel);
+    if (ctx_params.n_seq_max > 1) {
+        // n_ctx is per sequence here; without one, give each sequence the training
+        // context capped like the pooled path, since the KV cache holds all of them
+        const int n_ctx_train = llama_model_n_ctx_train(model_);
+        const int n_ctx_seq = config.n_ctx > 0 ? config.n_ctx : std::min(n_ctx_train > 0 ? n_ctx_train : 8192, 8192);
+        ctx_params.n_ctx = static_cast<uint32_t>(n_ctx_seq) * ctx_params.n_seq_max;
+        // Share one KV pool so a single-sequence generate() still sees the full context
+        ctx_params.kv_unified = true;
+    }
+    
+    // A quantized V cache is only supported inside the flash attention kernel
+    const FlashAttention requested_flash_attn = config_.flash_attn;
+    if (config_.kv_type_v != KvCacheType::F16) {
+        if (config_.flash_attn == FlashAttention::Off) {
+            UI::print_warning("Quantized V cache needs flash attention; using f16 for V");
+            config_.kv_type_v = KvCacheType::F16;
+        } else {
+            config_.flash_attn = FlashAttention::On;
+        }
+    }
+    ctx_params.type_k = to_ggml_type(config_.kv_type_k);
+    ctx_params.type_v = to_ggml_type(config_.kv_type_v);
+    ctx_params.flash_attn_type = to_llama_flash_attn(config_.flash_attn);
     
     // Create context
     ctx_ = llama_init_from_model(model_, ctx_params);
+    if (!ctx_ && (config_.kv_type_k != KvCacheType::F16 || config_.kv_type_v != KvCacheType::F16)) {
+        // The backend may lack flash attention or quantized KV kernels for this model
+        UI::print_warning("Quantized KV cache is not supported here; falling back to f16");
+        config_.kv_type_k = KvCacheType::F16;
+        config_.kv_type_v = KvCacheType::F16;
+        ctx_params.type_k = GGML_TYPE_F16;
+        ctx_params.type_v = GGML_TYPE_F16;
+        // Flash attention may have been forced on for the quantized V cache alone
+        config_.flash_attn = requested_flash_attn;
+        ctx_params.flash_attn_type = to_llama_flash_attn(config_.flash_attn);
+        ctx_ = llama_init_from_model(model_, ctx_params);
+    }
     if (!ctx_) {
         UI::print_error("Failed to create context");
-        llama_model_free(model_);
+        model_handle_.reset();
         model_ = nullptr;
         return false;
     }
     
+    llama_set_abort_callback(ctx_, abort_requested, &cancel_requested_);
+    
     // Set up sampler
     setup_sampler();
+    build_piece_table();
+    
+    // Output constraint from the configuration; a bad grammar is an error, not a warning,
+    // since callers rely on the output matching it
+    if (!config_.json_schema.empty() ? !set_json_schema(config_.json_schema) : !set_grammar(config_.grammar)) {
+        unload_model();
+        return false;
+    }
+    
+    // Scratch for the token loop, as large as the context's batch
+    scratch_.reset(new GenerationScratch(config_.n_batch));
+    scratch_->early_stop.configure(config);
+    scratch_->draft.reserve(config_.n_draft);
+    scratch_->accepted.reserve(config_.n_draft + 1);
+    scratch_->candidates.reserve(llama_vocab_n_tokens(llama_model_get_vocab(model_)));
+    cached_tokens_.reserve(llama_n_ctx(ctx_));
     
+    model_fingerprint_ = model->fingerprint();
+    
+    // Rejected lookup drafts are dropped with a partial cache removal, which recurrent
+    // models cannot do
+    if (config_.lookup_ngram > 0 && llama_model_is_recurrent(model_)) {
+        UI::print_warning("Prompt-lookup decoding is not supported for recurrent models; disabling it");
+        config_.lookup_ngram = 0;
+    }
+    
+    // Speculative decoding is optional: fall back to plain decoding if the draft fails
+    if ((draft_model || !config.draft_model_path.empty()) && !load_draft_model(draft_model)) {
+        unload_draft_model();
+    }
+    
+    // Text-only use keeps working if the projector is missing or does not match
+    if (config.multimodal && !config.mmproj_path.empty()) {
+        load_projector();
+    }
+    
+    if (config.warmup) {
+        auto warmup_start = std::chrono::steady_clock::now();
+        warm_up_context(ctx_, model_);
+        if (draft_ctx_) {
+            warm_up_context(draft_ctx_, draft_model_);
+        }
+        warmup_ms_ = elapsed_ms(warmup_start);
+    }
+    
+    return true;
+}
+
+bool InferenceEngine::load_draft_model(std::shared_ptr<ModelHandle> draft) {
+    if (llama_model_is_recurrent(model_)) {
+        UI::print_warning("Speculative decoding is not supported for recurrent models; ignoring draft model");
+        return false;
+    }
+    
+    if (!draft) {
+        draft = ModelHandle::load(config_.draft_model_path, config_);
+    }
+    if (!draft) {
+        UI::print_warning("Failed to load draft model: " + config_.draft_model_path);
+        return false;
+    }
+    draft_model_handle_ = draft;
+    draft_model_ = draft->get();
+    
+    // Drafted token ids are fed straight to the target model, so the vocabularies must agree
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    const llama_vocab* draft_vocab = llama_model_get_vocab(draft_model_);
+    if (llama_vocab_type(vocab) != llama_vocab_type(draft_vocab) ||
+        llama_vocab_bos(vocab) != llama_vocab_bos(draft_vocab) ||
+        llama_vocab_eos(vocab) != llama_vocab_eos(draft_vocab) ||
+        std::abs(llama_vocab_n_tokens(vocab) - llama_vocab_n_tokens(draft_vocab)) > 128) {
+        UI::print_warning("Draft model vocabulary does not match the target model; ignoring draft model");
+        return false;
+    }
+    
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = llama_n_ctx(ctx_);
+    ctx_params.n_batch = config_.n_batch;
+    ctx_params.n_ubatch = std::min(config_.n_ubatch, config_.n_batch);
+    ctx_params.n_threads = config_.n_threads;
+    ctx_params.n_threads_batch = config_.n_threads_batch;
+    ctx_params.type_k = to_ggml_type(config_.kv_type_k);
+    ctx_params.type_v = to_ggml_type(config_.kv_type_v);
+    ctx_params.flash_attn_type = to_llama_flash_attn(config_.flash_attn);
+    
+    draft_ctx_ = llama_init_from_model(draft_model_, ctx_params);
+    if (!draft_ctx_) {
+        UI::print_warning("Failed to create draft context");
+        return false;
+    }
     
     return true;
 }
 
+void InferenceEngine::unload_draft_model() {
+    if (draft_ctx_) {
+        llama_free(draft_ctx_);
+        draft_ctx_ = nullptr;
+    }
+    
+    draft_model_handle_.reset();
+    draft_model_ = nullptr;
+    
+    draft_cached_tokens_.clear();
+}
+
 void InferenceEngine::unload_model() {
+    unload_draft_model();
+    
+    if (mtmd_ctx_) {
+        mtmd_free(mtmd_ctx_);
+        mtmd_ctx_ = nullptr;
+    }
+    mmproj_fingerprint_.clear();
+    
+    if (pooled_ctx_) {
+        llama_free(pooled_ctx_);
+        pooled_ctx_ = nullptr;
+    }
+    
     if (sampler_) {
         llama_sampler_free(sampler_);
         sampler_ = nullptr;
     }
+    free_grammars();
     
     if (ctx_) {
         llama_free(ctx_);
         ctx_ = nullptr;
     }
     
-    if (model_) {
-        llama_model_free(model_);
-        model_ = nullptr;
+    // The weights themselves go when the last engine sharing them lets go
+    model_handle_.reset();
+    model_ = nullptr;
+    
+    cached_tokens_.clear();
+    model_fingerprint_.clear();
+    scratch_.reset();
+    piece_offsets_.clear();
+    piece_arena_.clear();
+}
+
+void InferenceEngine::reset_cache() {
+    if (ctx_) {
+        llama_memory_clear(llama_get_memory(ctx_), true);
     }
+    cached_tokens_.clear();
     
+    if (draft_ctx_) {
+        llama_memory_clear(llama_get_memory(draft_ctx_), true);
+    }
+    draft_cached_tokens_.clear();
 }
 
 void InferenceEngine::setup_sampler() {
@@ -131,6 +637,196 @@ void InferenceEngine::setup_sampler() {
     llama_sampler_chain_add(sampler_, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
 }
 
+llama_sampler* InferenceEngine::cached_grammar(uint64_t key, const std::function<std::string()>& make_grammar) {
+    auto it = grammar_cache_.find(key);
+    if (it == grammar_cache_.end()) {
+        const std::string grammar = make_grammar();
+        llama_sampler* sampler = llama_sampler_init_grammar(llama_model_get_vocab(model_), grammar.c_str(), "root");
+        if (!sampler) {
+            return nullptr;
+        }
+        
+        // Evict the least recently used grammar, but never the active one
+        if (grammar_cache_.size() >= kMaxCachedGrammars) {
+            auto lru = grammar_cache_.end();
+            for (auto entry = grammar_cache_.begin(); entry != grammar_cache_.end(); ++entry) {
+                if (entry->second.sampler != grammar_proto_ &&
+                    (lru == grammar_cache_.end() || entry->second.last_used < lru->second.last_used)) {
+                    lru = entry;
+                }
+            }
+            if (lru != grammar_cache_.end()) {
+                llama_sampler_free(lru->second.sampler);
+                grammar_cache_.erase(lru);
+            }
+        }
+        it = grammar_cache_.emplace(key, CachedGrammar{sampler, 0}).first;
+    }
+    it->second.last_used = ++grammar_clock_;
+    return it->second.sampler;
+}
+
+bool InferenceEngine::set_grammar(const std::string& grammar) {
+    if (grammar.empty()) {
+        grammar_proto_ = nullptr;
+        config_.grammar.clear();
+        config_.json_schema.clear();
+        return true;
+    }
+    if (!is_loaded()) {
+        throw std::runtime_error("Model not loaded");
+    }
+    
+    llama_sampler* proto = cached_grammar(tools::Hash::fnv1a64(grammar.data(), grammar.size()),
+                                          [&]() { return grammar; });
+    if (!proto) {
+        UI::print_error("Failed to parse grammar");
+        return false;
+    }
+    grammar_proto_ = proto;
+    config_.grammar = grammar;
+    config_.json_schema.clear();
+    return true;
+}
+
+bool InferenceEngine::set_json_schema(const std::string& schema) {
+    if (schema.empty()) {
+        return set_grammar("");
+    }
+    if (!is_loaded()) {
+        throw std::runtime_error("Model not loaded");
+    }
+    
+    // Schemas hash into their own key space, so a cache hit also skips the conversion
+    static const char kSchemaTag[] = "json-schema";
+    const uint64_t key = tools::Hash::fnv1a64(schema.data(), schema.size(),
+                                              tools::Hash::fnv1a64(kSchemaTag, sizeof(kSchemaTag)));
+    llama_sampler* proto = nullptr;
+    try {
+        proto = cached_grammar(key, [&]() { return json_schema_to_grammar(nlohmann::ordered_json::parse(schema)); });
+    } catch (const std::exception& e) {
+        UI::print_error(std::string("Invalid JSON schema: ") + e.what());
+        return false;
+    }
+    if (!proto) {
+        UI::print_error("Failed to parse the grammar generated from the JSON schema");
+        return false;
+    }
+    grammar_proto_ = proto;
+    config_.json_schema = schema;
+    config_.grammar.clear();
+    return true;
+}
+
+void InferenceEngine::reset_grammar() {
+    if (grammar_) {
+        llama_sampler_free(grammar_);
+        grammar_ = nullptr;
+    }
+    if (grammar_proto_) {
+        grammar_ = llama_sampler_clone(grammar_proto_);
+    }
+}
+
+void InferenceEngine::free_grammars() {
+    if (grammar_) {
+        llama_sampler_free(grammar_);
+        grammar_ = nullptr;
+    }
+    for (auto& entry : grammar_cache_) {
+        llama_sampler_free(entry.second.sampler);
+    }
+    grammar_cache_.clear();
+    grammar_proto_ = nullptr;
+}
+
+
+bool InferenceEngine::shift_context(int n_needed) {
+    llama_memory_t mem = llama_get_memory(ctx_);
+    if (!config_.context_shift || !llama_memory_can_shift(mem)) {
+        return false;
+    }
+    
+    // Keep the first n_keep tokens (attention sinks / system prompt) and drop the
+    // oldest half of the rest, or more if that still leaves too little room
+    const int n_ctx = llama_n_ctx(ctx_);
+    const int n_past = static_cast<int>(cached_tokens_.size());
+    const int n_keep = std::min(std::max(config_.n_keep, 0), n_past);
+    const int n_left = n_past - n_keep;
+    const int n_discard = std::max(n_left / 2, n_past + n_needed - n_ctx);
+    if (n_discard <= 0 || n_discard > n_left) {
+        return false;
+    }
+    
+    // Remove the range and slide the remaining positions down; the cache entries
+    // themselves are reused so nothing has to be decoded again
+    if (!llama_memory_seq_rm(mem, 0, n_keep, n_keep + n_discard)) {
+        return false;
+    }
+    llama_memory_seq_add(mem, 0, n_keep + n_discard, n_past, -n_discard);
+    cached_tokens_.erase(cached_tokens_.begin() + n_keep, cached_tokens_.begin() + n_keep + n_discard);
+    last_stats_.n_discarded_tokens += n_discard;
+    
+    // The draft cache no longer lines up with the target; let it re-sync from scratch
+    if (draft_ctx_) {
+        llama_memory_clear(llama_get_memory(draft_ctx_), true);
+        draft_cached_tokens_.clear();
+    }
+    return true;
+}
+
+void InferenceEngine::discard_aborted_decode() {
+    // An aborted llama_decode() keeps the micro-batches it had finished
+    if (!llama_memory_seq_rm(llama_get_memory(ctx_), 0, static_cast<llama_pos>(cached_tokens_.size()), -1)) {
+        reset_cache();
+    }
+}
+
+std::string InferenceEngine::session_state_path(const std::string& dir) const {
+    return tools::FileOps::join_path(dir, "kv-" + model_fingerprint_ + ".bin");
+}
+
+bool InferenceEngine::save_session_state(const std::string& dir) {
+    if (!is_loaded() || model_fingerprint_.empty() || cached_tokens_.empty() || dir.empty()) {
+        return false;
+    }
+    if (!tools::FileOps::dir_exists(dir) && !tools::FileOps::create_dir(dir)) {
+        return false;
+    }
+    
+    // Write to a temporary file first so an interrupted save never leaves a torn snapshot
+    const std::string path = session_state_path(dir);
+    const std::string temp_path = path + ".tmp";
+    std::vector<llama_token> tokens(cached_tokens_.begin(), cached_tokens_.end());
+    if (llama_state_seq_save_file(ctx_, temp_path.c_str(), 0, tokens.data(), tokens.size()) == 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    std::remove(path.c_str());
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+bool InferenceEngine::load_session_state(const std::string& dir) {
+    if (!is_loaded() || model_fingerprint_.empty() || dir.empty()) {
+        return false;
+    }
+    
+    const std::string path = session_state_path(dir);
+    if (!tools::FileOps::file_exists(path)) {
+        return false;
+    }
+    
+    reset_cache();
+    std::vector<llama_token> tokens(llama_n_ctx(ctx_));
+    size_t n_tokens = 0;
+    if (llama_state_seq_load_file(ctx_, path.c_str(), 0, tokens.data(), tokens.size(), &n_tokens) == 0) {
+        // Incompatible snapshot (e.g. larger than the current context): start cold
+        reset_cache();
+        return false;
+    }
+    cached_tokens_.assign(tokens.begin(), tokens.begin() + n_tokens);
+    return true;
+}
 
 std::vector<int> InferenceEngine::tokenize(const std::string& text, bool add_bos) {
     if (!model_ || !ctx_) {
@@ -139,12 +835,8 @@ std::vector<int> InferenceEngine::tokenize(const std::string& text, bool add_bos
 
     const llama_vocab* vocab = llama_model_get_vocab(model_);
 
-    // Mirror tools/run/run.cpp logic: add BOS only for the first prompt in the session
-    const bool is_first = llama_memory_seq_pos_max(llama_get_memory(ctx_), 0) == -1;
-    const bool add_bos_effective = add_bos && is_first;
-
     // Allocate an initial buffer; llama_tokenize returns negative if buffer too small
-    int estimated = static_cast<int>(text.size()) + (add_bos_effective ? 2 : 1);
+    int estimated = static_cast<int>(text.size()) + (add_bos ? 2 : 1);
     std::vector<llama_token> buf(std::max(estimated, 8));
 
     int n = llama_tokenize(
@@ -153,7 +845,7 @@ std::vector<int> InferenceEngine::tokenize(const std::string& text, bool add_bos
         static_cast<int>(text.size()),
         buf.data(),
         static_cast<int>(buf.size()),
-        add_bos_effective,
+        add_bos,
         /*parse_special=*/true);
 
     if (n == std::numeric_limits<int32_t>::min()) {
@@ -168,7 +860,7 @@ std::vector<int> InferenceEngine::tokenize(const std::string& text, bool add_bos
             static_cast<int>(text.size()),
             buf.data(),
             static_cast<int>(buf.size()),
-            add_bos_effective,
+            add_bos,
             /*parse_special=*/true);
         if (check != -n) {
             throw std::runtime_error("Tokenization failed: size mismatch");
@@ -181,147 +873,1538 @@ std::vector<int> InferenceEngine::tokenize(const std::string& text, bool add_bos
     return std::vector<int>(buf.begin(), buf.end());
 }
 
-std::string InferenceEngine::detokenize(const std::vector<int>& tokens) {
+std::string InferenceEngine::format_chat(const std::vector<ChatMessage>& messages) {
     if (!model_) {
         throw std::runtime_error("Model not loaded");
     }
+    const char* tmpl = llama_model_chat_template(model_, nullptr);
+    if (!tmpl || messages.empty()) {
+        return "";
+    }
     
-    const llama_vocab* vocab = llama_model_get_vocab(model_);
-    std::string result;
+    std::vector<llama_chat_message> chat;
+    chat.reserve(messages.size());
+    size_t n_chars = 0;
+    for (const auto& message : messages) {
+        chat.push_back(llama_chat_message{message.role.c_str(), message.content.c_str()});
+        n_chars += message.role.size() + message.content.size();
+    }
+    
+    // The result is larger than the input by the template's markup; retry with the
+    // exact size when that guess is too small
+    std::vector<char> buf(n_chars * 2 + 256);
+    int32_t n = llama_chat_apply_template(tmpl, chat.data(), chat.size(), true, buf.data(), static_cast<int32_t>(buf.size()));
+    if (n > static_cast<int32_t>(buf.size())) {
+        buf.resize(n);
+        n = llama_chat_apply_template(tmpl, chat.data(), chat.size(), true, buf.data(), static_cast<int32_t>(buf.size()));
+    }
+    if (n < 0) {
+        return "";
+    }
+    std::string prompt(buf.data(), static_cast<size_t>(n));
+    
+    // Templates spell out BOS themselves; tokenize() adds it as well for such vocabs
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    if (llama_vocab_get_add_bos(vocab) && llama_vocab_bos(vocab) != LLAMA_TOKEN_NULL) {
+        const char* bos = llama_vocab_get_text(vocab, llama_vocab_bos(vocab));
+        const size_t n_bos = bos ? std::strlen(bos) : 0;
+        if (n_bos > 0 && prompt.compare(0, n_bos, bos) == 0) {
+            prompt.erase(0, n_bos);
+        }
+    }
+    return prompt;
+}
+
+std::string InferenceEngine::detokenize(const std::vector<int>& tokens) {
+    if (!model_) {
+        throw std::runtime_error("Model not loaded");
+    }
     
+    // Size the result first, then copy each piece straight out of the table
+    size_t n_bytes = 0;
+    std::string_view piece;
     for (int token : tokens) {
-        char buf[256];
-        int n = llama_token_to_piece(vocab, token, buf, sizeof(buf), 0, true);
-        if (n > 0) {
-            result += std::string(buf, n);
+        if (token_to_piece(token, piece)) {
+            n_bytes += piece.size();
+        }
+    }
+    
+    std::string result;
+    result.reserve(n_bytes);
+    for (int token : tokens) {
+        if (token_to_piece(token, piece)) {
+            result.append(piece.data(), piece.size());
         }
     }
     
     return result;
 }
 
+void InferenceEngine::build_piece_table() {
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    
+    piece_offsets_.assign(static_cast<size_t>(n_vocab) + 1, 0);
+    piece_arena_.clear();
+    piece_arena_.reserve(static_cast<size_t>(n_vocab) * 8);
+    
+    std::vector<char> buf(256);
+    for (int token = 0; token < n_vocab; token++) {
+        int n = llama_token_to_piece(vocab, token, buf.data(), static_cast<int32_t>(buf.size()), 0, true);
+        if (n < 0) {
+            buf.resize(static_cast<size_t>(-n));
+            n = llama_token_to_piece(vocab, token, buf.data(), static_cast<int32_t>(buf.size()), 0, true);
+        }
+        if (n > 0) {
+            piece_arena_.append(buf.data(), static_cast<size_t>(n));
+        }
+        piece_offsets_[token + 1] = static_cast<uint32_t>(piece_arena_.size());
+    }
+    piece_arena_.shrink_to_fit();
+}
+
+bool InferenceEngine::token_to_piece(int token, std::string_view& piece) const {
+    if (token < 0 || static_cast<size_t>(token) + 1 >= piece_offsets_.size()) {
+        return false;
+    }
+    const uint32_t begin = piece_offsets_[token];
+    piece = std::string_view(piece_arena_.data() + begin, piece_offsets_[token + 1] - begin);
+    return true;
+}
+
+// Number of bytes in a UTF-8 sequence, from its lead byte (1 for invalid lead bytes)
+static size_t utf8_sequence_length(unsigned char lead) {
+    if ((lead & 0xE0) == 0xC0) return 2;
+    if ((lead & 0xF0) == 0xE0) return 3;
+    if ((lead & 0xF8) == 0xF0) return 4;
+    return 1;
+}
+
+std::string_view IncrementalDetokenizer::push(std::string_view piece) {
+    // Drop what was returned last time; at most 3 held-back bytes move to the front
+    buffer_.erase(0, n_emitted_);
+    buffer_.append(piece.data(), piece.size());
+    
+    // Look for a lead byte among the last 3 bytes whose sequence is not complete yet
+    size_t n_complete = buffer_.size();
+    for (size_t back = 1; back <= 3 && back <= buffer_.size(); back++) {
+        const unsigned char c = static_cast<unsigned char>(buffer_[buffer_.size() - back]);
+        if ((c & 0xC0) == 0x80) {
+            continue;   // continuation byte, keep looking for the lead byte
+        }
+        if (utf8_sequence_length(c) > back) {
+            n_complete = buffer_.size() - back;
+        }
+        break;
+    }
+    
+    n_emitted_ = n_complete;
+    return std::string_view(buffer_.data(), n_complete);
+}
+
+std::string_view IncrementalDetokenizer::flush() {
+    buffer_.erase(0, n_emitted_);
+    n_emitted_ = buffer_.size();
+    return std::string_view(buffer_.data(), buffer_.size());
+}
+
+void IncrementalDetokenizer::reset() {
+    buffer_.clear();
+    n_emitted_ = 0;
+}
+
+// Multiplier of the polynomial rolling hash over token ids (odd, so invertible mod 2^64)
+static const uint64_t kRepetitionHashBase = 0x100000001b3ULL;
+
+void RepetitionDetector::configure(int ngram, int max_repeats, int window) {
+    ngram_ = ngram > 0 && max_repeats > 1 && window > 0 ? ngram : 0;
+    max_repeats_ = max_repeats;
+    window_ = ngram_ > 0 ? static_cast<size_t>(window) : 0;
+    
+    base_pow_ = 1;
+    for (int i = 0; i < ngram_; i++) {
+        base_pow_ *= kRepetitionHashBase;
+    }
+    
+    // At most 2 * window_ distinct keys between purges (the live window plus the
+    // window_ pushes since the last rebuild), so a table of 4 * window_ stays at most
+    // half full
+    size_t table_size = 1;
+    while (table_size < window_ * 4) {
+        table_size <<= 1;
+    }
+    tokens_.assign(static_cast<size_t>(ngram_), 0);
+    hashes_.assign(window_, 0);
+    keys_.assign(ngram_ > 0 ? table_size : 0, 0);
+    last_.assign(keys_.size(), 0);
+    reset();
+}
+
+void RepetitionDetector::reset() {
+    hash_ = 0;
+    n_pushed_ = 0;
+    n_since_rebuild_ = 0;
+    period_ = 0;
+    run_ = 0;
+    std::fill(keys_.begin(), keys_.end(), 0);
+}
+
+size_t RepetitionDetector::find_slot(uint64_t key) const {
+    const size_t mask = keys_.size() - 1;
+    size_t slot = static_cast<size_t>(key ^ (key >> 29)) & mask;
+    while (keys_[slot] != 0 && keys_[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void RepetitionDetector::rebuild_table() {
+    // Drop n-grams that left the window by re-inserting the live ones, newest first
+    std::fill(keys_.begin(), keys_.end(), 0);
+    const size_t n_grams = n_pushed_ - static_cast<size_t>(ngram_) + 1;
+    const size_t n_live = std::min(window_, n_grams);
+    for (size_t i = 0; i < n_live; i++) {
+        const uint64_t key = hashes_[(n_pushed_ - 1 - i) % window_];
+        const size_t slot = find_slot(key);
+        if (keys_[slot] == 0) {
+            keys_[slot] = key;
+            last_[slot] = n_grams - 1 - i;
+        }
+    }
+    n_since_rebuild_ = 0;
+}
+
+bool RepetitionDetector::push(int token) {
+    if (ngram_ == 0) {
+        return false;
+    }
+    
+    // Slide the n-gram window: add the new token, remove the one that fell out
+    const size_t pos = n_pushed_ % static_cast<size_t>(ngram_);
+    const uint64_t value = static_cast<uint64_t>(static_cast<uint32_t>(token)) + 1;
+    hash_ = hash_ * kRepetitionHashBase + value;
+    if (n_pushed_ >= static_cast<size_t>(ngram_)) {
+        hash_ -= base_pow_ * (static_cast<uint64_t>(static_cast<uint32_t>(tokens_[pos])) + 1);
+    }
+    tokens_[pos] = token;
+    n_pushed_++;
+    if (n_pushed_ < static_cast<size_t>(ngram_)) {
+        return false;
+    }
+    
+    // n-gram index of the newest entry and its place in the ring
+    const size_t index = n_pushed_ - static_cast<size_t>(ngram_);
+    const size_t ring = (n_pushed_ - 1) % window_;
+    const uint64_t key = hash_ | 1;     // 0 marks empty slots
+    
+    // Extend the current loop while each n-gram matches the one a period back;
+    // otherwise start a new candidate loop at this n-gram's previous occurrence
+    if (period_ > 0 && hashes_[(n_pushed_ - 1 - period_) % window_] == key) {
+        run_++;
+    } else {
+        period_ = 0;
+        run_ = 0;
+        const size_t slot = find_slot(key);
+        if (keys_[slot] == key && index - last_[slot] < window_) {
+            period_ = index - last_[slot];
+            run_ = 1;
+        }
+    }
+    
+    hashes_[ring] = key;
+    const size_t slot = find_slot(key);
+    keys_[slot] = key;
+    last_[slot] = index;
+    if (++n_since_rebuild_ >= window_) {
+        rebuild_table();
+    }
+    
+    // run_ matching n-grams cover run_ + ngram_ - 1 tokens equal to those a period
+    // back; max_repeats_ copies of a block of at least ngram_ tokens need
+    // (max_repeats_ - 1) blocks of them
+    if (run_ == 0) {
+        return false;
+    }
+    const size_t block = std::max(period_, static_cast<size_t>(ngram_));
+    return run_ + static_cast<size_t>(ngram_) - 1 >= static_cast<size_t>(max_repeats_ - 1) * block;
+}
+
+void EarlyStop::configure(const InferenceConfig& config) {
+    sentence_stop_tokens_ = config.sentence_stop_tokens;
+    repetition_.configure(config.repeat_stop_ngram, config.repeat_stop_count, config.repeat_stop_window);
+    reset(false);
+}
+
+void EarlyStop::reset(bool constrained) {
+    constrained_ = constrained;
+    n_pushed_ = 0;
+    repetition_.reset();
+}
+
+bool EarlyStop::push(int token, std::string_view piece) {
+    n_pushed_++;
+    if (constrained_) {
+        return false;
+    }
+    
+    // First sentence end past the threshold
+    if (sentence_stop_tokens_ > 0 && n_pushed_ >= sentence_stop_tokens_ && !piece.empty()) {
+        const char last_char = piece.back();
+        if (last_char == '.' || last_char == '!' || last_char == '?') {
+            return true;
+        }
+    }
+    
+    // Repeating token runs
+    return repetition_.push(token);
+}
+
 std::string InferenceEngine::generate(const std::string& prompt, int max_tokens, bool stream) {
+    EchoStringTokenSink sink(stream);
+    generate(prompt, max_tokens, sink);
+    return sink.take();
+}
+
+void InferenceEngine::generate(const std::string& prompt, int max_tokens, TokenSink& sink) {
     if (!is_loaded()) {
         throw std::runtime_error("Model not loaded");
     }
     
-    // Use a simple, direct prompt without modifications
-    std::string clean_prompt = prompt;
-    
     // Tokenize prompt
-    auto tokens = tokenize(clean_prompt, true);
-    return generate_internal(tokens, max_tokens, stream);
+    auto tokens = tokenize(prompt, true);
+    generate_internal(tokens, max_tokens, sink);
 }
 
-std::string InferenceEngine::generate_internal(const std::vector<int>& tokens, 
-                                               int max_tokens, 
-                                               bool stream) {
+GenerationHandle InferenceEngine::generate_async(const std::string& prompt, int max_tokens) {
     if (!is_loaded()) {
         throw std::runtime_error("Model not loaded");
     }
     
-    // Clear memory to ensure clean context
-    llama_memory_clear(llama_get_memory(ctx_), true);
+    GenerationHandle handle;
+    handle.engine_ = this;
+    handle.state_ = std::make_shared<GenerationHandle::State>();
+    std::shared_ptr<GenerationHandle::State> state = handle.state_;
+    handle.result_ = std::async(std::launch::async, [this, state, prompt, max_tokens]() {
+        // Marking the handle done and clearing the cancel flag happen under one lock,
+        // so a late cancel() cannot leak into the engine's next generation
+        auto finish = [&]() {
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->done = true;
+                cancel_requested_.store(false);
+            }
+            state->ready.notify_all();
+        };
+        QueueTokenSink sink(*state);
+        try {
+            generate(prompt, max_tokens, sink);
+        } catch (...) {
+            finish();
+            throw;
+        }
+        finish();
+        return sink.take();
+    });
+    return handle;
+}
+
+GenerationHandle& GenerationHandle::operator=(GenerationHandle&& other) noexcept {
+    if (this != &other) {
+        stop();
+        engine_ = other.engine_;
+        state_ = std::move(other.state_);
+        result_ = std::move(other.result_);
+        other.engine_ = nullptr;
+    }
+    return *this;
+}
+
+GenerationHandle::~GenerationHandle() {
+    stop();
+}
+
+void GenerationHandle::stop() {
+    if (result_.valid()) {
+        cancel();
+        result_.wait();
+    }
+}
+
+bool GenerationHandle::next_piece(std::string& piece) {
+    if (!state_) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->ready.wait(lock, [this] { return !state_->pieces.empty() || state_->done; });
+    if (state_->pieces.empty()) {
+        return false;
+    }
+    piece = std::move(state_->pieces.front());
+    state_->pieces.pop_front();
+    return true;
+}
+
+void GenerationHandle::cancel() {
+    if (!state_ || !engine_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (!state_->done) {
+        engine_->cancel();
+    }
+}
+
+void InferenceEngine::generate_internal(const std::vector<int>& tokens, 
+                                        int max_tokens, 
+                                        TokenSink& sink) {
+    if (!is_loaded()) {
+        throw std::runtime_error("Model not loaded");
+    }
+    
+    CancelScope cancel_scope(cancel_requested_);
+    auto t_start = std::chrono::steady_clock::now();
+    llama_memory_t mem = llama_get_memory(ctx_);
     
     // Convert to llama_token
     std::vector<llama_token> prompt_tokens(tokens.begin(), tokens.end());
-    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    if (prompt_tokens.empty()) {
+        throw std::runtime_error("Empty prompt");
+    }
     
     // Reset sampler
     llama_sampler_reset(sampler_);
+    reset_grammar();
     
-    // Create batch for prompt
-    llama_batch batch = llama_batch_get_one(prompt_tokens.data(), prompt_tokens.size());
     // Basic ctx capacity check similar to tools/run/run.cpp
-    {
-        const int n_ctx = llama_n_ctx(ctx_);
-        const int n_ctx_used = llama_memory_seq_pos_max(llama_get_memory(ctx_), 0);
-        if (n_ctx_used + batch.n_tokens > n_ctx) {
-            throw std::runtime_error("Context size exceeded while submitting prompt");
-        }
+    const int n_ctx = llama_n_ctx(ctx_);
+    int n_truncated = 0;
+    if (config_.context_shift && static_cast<int>(prompt_tokens.size()) >= n_ctx) {
+        // Keep the first n_keep tokens and the most recent tokens, filling half the
+        // context so there is room left to generate
+        const int n_keep = std::min(std::max(config_.n_keep, 0), n_ctx / 2);
+        const int n_tail = n_ctx / 2 - n_keep;
+        n_truncated = static_cast<int>(prompt_tokens.size()) - n_keep - n_tail;
+        prompt_tokens.erase(prompt_tokens.begin() + n_keep, prompt_tokens.begin() + n_keep + n_truncated);
+    } else if (static_cast<int>(prompt_tokens.size()) > n_ctx) {
+        throw std::runtime_error("Context size exceeded while submitting prompt");
     }
     
-    // Evaluate prompt
-    if (llama_decode(ctx_, batch)) {
-        throw std::runtime_error("Failed to evaluate prompt");
+    // Reuse the longest common prefix with what is already in the KV cache and
+    // only trim the divergent tail. The last prompt token is always re-decoded so
+    // fresh logits are available for sampling the first response token.
+    size_t n_reuse = common_prefix_length(cached_tokens_, prompt_tokens);
+    if (n_reuse >= prompt_tokens.size()) {
+        n_reuse = prompt_tokens.size() - 1;
     }
+    if (n_reuse > 0 && !llama_memory_seq_rm(mem, 0, static_cast<llama_pos>(n_reuse), -1)) {
+        // Some memory types (e.g. recurrent) cannot drop a partial range
+        n_reuse = 0;
+    }
+    if (n_reuse == 0) {
+        llama_memory_clear(mem, true);
+    }
+    cached_tokens_.resize(n_reuse);
     
-    std::string response;
+    last_stats_ = GenerationStats();
+    last_stats_.n_prompt_tokens = static_cast<int>(prompt_tokens.size());
+    last_stats_.n_reused_tokens = static_cast<int>(n_reuse);
+    last_stats_.n_discarded_tokens = n_truncated;
     
-    // Generate tokens with aggressive stopping for concise responses
-    for (int i = 0; i < max_tokens; i++) {
-        // Sample next token
-        llama_token token = llama_sampler_sample(sampler_, ctx_, -1);
+    // Evaluate the uncached prompt suffix in n_batch sized chunks so long prompts
+    // neither exceed the context's batch limit nor block without feedback
+    auto t_prefill = std::chrono::steady_clock::now();
+    const int n_batch = std::max(1, static_cast<int>(llama_n_batch(ctx_)));
+    const int n_prefill = static_cast<int>(prompt_tokens.size() - n_reuse);
+    for (int n_done = 0; n_done < n_prefill; ) {
+        const int n_chunk = std::min(n_batch, n_prefill - n_done);
+        llama_token* chunk = prompt_tokens.data() + n_reuse + n_done;
+        if (llama_decode(ctx_, llama_batch_get_one(chunk, n_chunk))) {
+            if (cancel_requested_) {
+                discard_aborted_decode();
+                last_stats_.prefill_ms = elapsed_ms(t_prefill);
+                last_stats_.cancelled = true;
+                sink.on_finish();
+                return;
+            }
+            reset_cache();
+            throw std::runtime_error("Failed to evaluate prompt");
+        }
+        cached_tokens_.insert(cached_tokens_.end(), chunk, chunk + n_chunk);
+        n_done += n_chunk;
+        
+        const double ms = elapsed_ms(t_prefill);
+        const double tokens_per_sec = ms > 0.0 ? n_done * 1000.0 / ms : 0.0;
+        if ((!sink.on_prefill_progress(n_done, n_prefill, tokens_per_sec) || cancel_requested_) && n_done < n_prefill) {
+            // Cancelled: what was decoded stays cached for the next call
+            last_stats_.prefill_ms = ms;
+            last_stats_.cancelled = true;
+            sink.on_finish();
+            return;
+        }
+    }
+    last_stats_.prefill_ms = elapsed_ms(t_prefill);
+    
+    // Speculate with the draft model or, without one, by prompt lookup. Drafts do not
+    // know the grammar, so constrained output decodes plainly.
+    const bool speculative = (draft_ctx_ != nullptr || config_.lookup_ngram > 0) && !grammar_;
+    generate_tokens(max_tokens, sink, t_start, speculative);
+}
+
+void InferenceEngine::generate_tokens(int max_tokens,
+                                      TokenSink& sink,
+                                      std::chrono::steady_clock::time_point t_start,
+                                      bool speculative) {
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    const int n_ctx = llama_n_ctx(ctx_);
+    auto t_decode = std::chrono::steady_clock::now();
+    const bool want_logprobs = sink.wants_logprobs();
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    IncrementalDetokenizer& utf8 = scratch_->utf8;
+    EarlyStop& early_stop = scratch_->early_stop;
+    utf8.reset();
+    early_stop.reset(grammar_ != nullptr);
+    TokenEvent event;
+    int n_emitted = 0;
+    
+    // Deliver one sampled token; `i_logits` is the batch index holding its logits.
+    // Returns false once generation should stop.
+    auto emit = [&](llama_token token, int32_t i_logits) -> bool {
+        if (cancel_requested_) {
+            last_stats_.cancelled = true;
+            return false;
+        }
         
         // Check for EOS token
-        if (llama_vocab_is_eog(vocab, token)) {
-            break;
+        if (n_emitted >= max_tokens || llama_vocab_is_eog(vocab, token)) {
+            return false;
         }
         
-        // Convert token to string
-        std::string piece;
-        if (convert_token_to_string(vocab, token, piece)) {
-            break;
+        // Convert token to string, holding back incomplete UTF-8 characters
+        std::string_view piece;
+        if (!token_to_piece(token, piece)) {
+            return false;
         }
+        piece = utf8.push(piece);
         
-        // Print and concatenate response
-        if (stream) {
-            print_word_and_concatenate_to_response(piece, response);
-        } else {
-            response += piece;
+        // Hand the token to the sink
+        event.token = token;
+        event.piece = piece;
+        event.logprob = want_logprobs ? token_logprob(llama_get_logits_ith(ctx_, i_logits), n_vocab, token) : 0.0f;
+        event.t_ms = elapsed_ms(t_start);
+        event.index = n_emitted++;
+        sink.on_token(event);
+        last_stats_.n_generated_tokens++;
+        
+        // Early stopping for concise responses and against repetition loops
+        return !early_stop.push(token, piece);
+    };
+    
+    if (speculative) {
+        // Speculative decoding: the draft model proposes a run of tokens and the target
+        // model checks all of them in a single batched decode.
+        std::vector<int>& draft = scratch_->draft;
+        std::vector<int>& accepted = scratch_->accepted;
+        llama_token id_last = sample_constrained(ctx_, -1, sampler_, nullptr, scratch_->candidates);
+        bool running = emit(id_last, -1);
+        while (running) {
+            // Room for the draft after id_last has been written
+            int n_room = n_ctx - static_cast<int>(cached_tokens_.size()) - 1;
+            if (n_room <= 0 && shift_context(1 + config_.n_draft)) {
+                n_room = n_ctx - static_cast<int>(cached_tokens_.size()) - 1;
+            }
+            if (n_room <= 0) {
+                break;
+            }
+            const int n_max = std::min({config_.n_draft, max_tokens - n_emitted, n_room});
+            draft.clear();
+            if (n_max > 0 && draft_ctx_) {
+                draft_tokens(id_last, n_max, draft);
+            } else if (n_max > 0) {
+                lookup_draft(id_last, n_max, draft);
+            }
+            if (!verify_draft(id_last, draft, accepted)) {
+                break;
+            }
+            for (size_t i = 0; i < accepted.size() && running; i++) {
+                running = emit(accepted[i], static_cast<int32_t>(i));
+            }
+            id_last = accepted.back();
+        }
+        if (cancel_requested_) {
+            last_stats_.cancelled = true;
+        }
+    } else {
+        // Generate tokens with aggressive stopping for concise responses
+        llama_batch& next_batch = scratch_->batch;
+        while (true) {
+            // Sample next token
+            llama_token token = sample_constrained(ctx_, -1, sampler_, grammar_, scratch_->candidates);
+            if (!emit(token, -1)) {
+                break;
+            }
+            
+            // Prepare next batch. Positions are explicit because after an image the
+            // next position is not always the number of KV cells in use (M-RoPE).
+            if (static_cast<int>(cached_tokens_.size()) + 1 > n_ctx && !shift_context(1)) {
+                break;
+            }
+            next_batch.n_tokens = 0;
+            batch_add(next_batch, token, static_cast<llama_pos>(cached_tokens_.size()), 0, true);
+            if (llama_decode(ctx_, next_batch)) {
+                if (cancel_requested_) {
+                    discard_aborted_decode();
+                    last_stats_.cancelled = true;
+                } else {
+                    // KV contents are no longer known to match cached_tokens_
+                    reset_cache();
+                }
+                break;
+            }
+            cached_tokens_.push_back(token);
+        }
+    }
+    last_stats_.decode_ms = elapsed_ms(t_decode);
+    
+    sink.on_finish();
+}
+
+// Per-sequence state for the multi-sequence scheduler
+struct SequenceSlot {
+    bool active = false;
+    llama_seq_id seq_id = 0;
+    llama_sampler* sampler = nullptr;
+    llama_sampler* grammar = nullptr;   // this sequence's clone of the active grammar
+    std::vector<llama_token> prompt;
+    size_t n_prefilled = 0;     // prompt tokens already added to a batch
+    llama_pos n_past = 0;       // tokens in this sequence's KV cache
+    llama_token pending = 0;    // sampled token waiting to be decoded
+    bool has_pending = false;
+    int32_t i_batch = -1;       // batch index holding this slot's logits
+    BatchResult result;
+};
+
+// Index and softmax probability of the most likely token
+static llama_token greedy_token(const float* logits, int n_vocab, float& prob) {
+    llama_token best = 0;
+    for (int i = 1; i < n_vocab; i++) {
+        if (logits[i] > logits[best]) {
+            best = i;
+        }
+    }
+    double sum = 0.0;
+    for (int i = 0; i < n_vocab; i++) {
+        sum += std::exp(static_cast<double>(logits[i] - logits[best]));
+    }
+    prob = static_cast<float>(1.0 / sum);
+    return best;
+}
+
+void InferenceEngine::draft_tokens(int id_last, int n_max, std::vector<int>& draft) {
+    llama_memory_t mem = llama_get_memory(draft_ctx_);
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    const int n_vocab_target = llama_vocab_n_tokens(vocab);
+    const int n_vocab_draft = llama_vocab_n_tokens(llama_model_get_vocab(draft_model_));
+    
+    // Bring the draft cache up to cached_tokens_ + id_last, reusing the common prefix
+    size_t n_reuse = common_prefix_length(draft_cached_tokens_, cached_tokens_);
+    if (n_reuse > 0 && !llama_memory_seq_rm(mem, 0, static_cast<llama_pos>(n_reuse), -1)) {
+        n_reuse = 0;
+    }
+    if (n_reuse == 0) {
+        llama_memory_clear(mem, true);
+    }
+    draft_cached_tokens_.resize(n_reuse);
+    
+    // Decode cached_tokens_[n_reuse..] followed by id_last, in batch sized chunks
+    llama_batch& batch = scratch_->batch;
+    const size_t n_batch = static_cast<size_t>(std::max(1, std::min(scratch_->capacity,
+                                                                    static_cast<int32_t>(llama_n_batch(draft_ctx_)))));
+    const size_t n_pending = cached_tokens_.size() - n_reuse + 1;
+    bool ok = true;
+    for (size_t start = 0; start < n_pending && ok; start += n_batch) {
+        const size_t end = std::min(n_pending, start + n_batch);
+        batch.n_tokens = 0;
+        for (size_t i = start; i < end; i++) {
+            const llama_token token = i + 1 == n_pending ? id_last : cached_tokens_[n_reuse + i];
+            batch_add(batch, token, static_cast<llama_pos>(draft_cached_tokens_.size()), 0, i + 1 == n_pending);
+            draft_cached_tokens_.push_back(token);
+        }
+        ok = llama_decode(draft_ctx_, batch) == 0;
+    }
+    
+    // Greedy drafting, one token at a time, until the model loses confidence
+    while (ok && static_cast<int>(draft.size()) < n_max) {
+        float prob = 0.0f;
+        llama_token token = greedy_token(llama_get_logits_ith(draft_ctx_, -1), n_vocab_draft, prob);
+        if (prob < config_.draft_p_min || token >= n_vocab_target) {
+            break;
+        }
+        draft.push_back(token);
+        if (llama_vocab_is_eog(vocab, token) || static_cast<int>(draft.size()) == n_max) {
+            break;
+        }
+        batch.n_tokens = 0;
+        batch_add(batch, token, static_cast<llama_pos>(draft_cached_tokens_.size()), 0, true);
+        draft_cached_tokens_.push_back(token);
+        ok = llama_decode(draft_ctx_, batch) == 0;
+    }
+    
+    if (!ok) {
+        // Draft cache is out of sync; start over on the next call
+        llama_memory_clear(mem, true);
+        draft_cached_tokens_.clear();
+    }
+}
+
+void InferenceEngine::lookup_draft(int id_last, int n_max, std::vector<int>& draft) const {
+    draft.clear();
+    const int n_cached = static_cast<int>(cached_tokens_.size());
+    const int n_total = n_cached + 1;
+    auto at = [&](int i) { return i < n_cached ? cached_tokens_[i] : id_last; };
+    
+    // Longest n-gram first; single-token matches are too weak to be worth a verify
+    // step unless that is all that was asked for
+    const int n_min = std::min(2, config_.lookup_ngram);
+    for (int n = std::min(config_.lookup_ngram, n_total - 1); n >= n_min; n--) {
+        const int i_tail = n_total - n;
+        for (int start = i_tail - 1; start >= 0; start--) {
+            int k = 0;
+            while (k < n && at(start + k) == at(i_tail + k) && at(start + k) != LLAMA_TOKEN_NULL) {
+                k++;
+            }
+            if (k < n) {
+                continue;
+            }
+            // Image positions hold placeholders, never copy them
+            for (int i = start + n; i < n_total && static_cast<int>(draft.size()) < n_max; i++) {
+                if (at(i) == LLAMA_TOKEN_NULL) {
+                    break;
+                }
+                draft.push_back(at(i));
+            }
+            if (!draft.empty()) {
+                return;
+            }
+        }
+    }
+}
+
+bool InferenceEngine::verify_draft(int id_last, const std::vector<int>& draft, std::vector<int>& accepted) {
+    llama_memory_t mem = llama_get_memory(ctx_);
+    const llama_pos n_past = static_cast<llama_pos>(cached_tokens_.size());
+    
+    // id_last followed by the draft, with logits at every position
+    llama_batch& batch = scratch_->batch;
+    batch.n_tokens = 0;
+    batch_add(batch, id_last, n_past, 0, true);
+    for (size_t i = 0; i < draft.size(); i++) {
+        batch_add(batch, draft[i], n_past + 1 + static_cast<llama_pos>(i), 0, true);
+    }
+    if (llama_decode(ctx_, batch) != 0) {
+        reset_cache();
+        return false;
+    }
+    cached_tokens_.push_back(id_last);
+    
+    // Sample with the target's own sampler at each position; keep drafted tokens
+    // for as long as the target agrees and finish with the first token it picks itself.
+    accepted.clear();
+    for (size_t i = 0; i <= draft.size(); i++) {
+        llama_token token = sample_constrained(ctx_, static_cast<int32_t>(i), sampler_, nullptr, scratch_->candidates);
+        accepted.push_back(token);
+        if (i == draft.size() || token != draft[i]) {
+            break;
+        }
+        cached_tokens_.push_back(token);
+    }
+    
+    // Drop the KV entries of rejected draft tokens
+    if (cached_tokens_.size() < static_cast<size_t>(n_past) + 1 + draft.size() &&
+        !llama_memory_seq_rm(mem, 0, static_cast<llama_pos>(cached_tokens_.size()), -1)) {
+        reset_cache();
+        return false;
+    }
+    
+    last_stats_.n_drafted += static_cast<int>(draft.size());
+    last_stats_.n_draft_accepted += static_cast<int>(accepted.size() - 1);
+    return true;
+}
+
+std::vector<std::string> InferenceEngine::generate_batch(const std::vector<std::string>& prompts, int max_tokens) {
+    if (!is_loaded()) {
+        throw std::runtime_error("Model not loaded");
+    }
+    
+    std::vector<std::string> responses(prompts.size());
+    size_t next = 0;
+    run_sequences(
+        [&](size_t& index, std::vector<int>& tokens) {
+            if (next >= prompts.size()) {
+                return false;
+            }
+            index = next;
+            tokens = tokenize(prompts[next], true);
+            next++;
+            return true;
+        },
+        [&](BatchResult&& result) {
+            responses[result.index] = std::move(result.text);
+        },
+        max_tokens);
+    
+    return responses;
+}
+
+void InferenceEngine::generate_batch(const std::function<bool(size_t& index, std::vector<int>& tokens)>& next_prompt,
+                                     const std::function<void(BatchResult&& result)>& on_result,
+                                     int max_tokens) {
+    if (!is_loaded()) {
+        throw std::runtime_error("Model not loaded");
+    }
+    run_sequences(next_prompt, on_result, max_tokens);
+}
+
+void InferenceEngine::run_sequences(const std::function<bool(size_t& index, std::vector<int>& tokens)>& next_prompt,
+                                    const std::function<void(BatchResult&& result)>& on_result,
+                                    int max_tokens) {
+    CancelScope cancel_scope(cancel_requested_);
+    llama_memory_t mem = llama_get_memory(ctx_);
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    
+    // Every active slot may add a token to the same decode, and llama_decode() rejects
+    // batches larger than the context's n_batch, so there are never more slots than that
+    const int n_batch = std::max(1, static_cast<int>(llama_n_batch(ctx_)));
+    const int n_slots = std::min(std::max(1, static_cast<int>(llama_n_seq_max(ctx_))), n_batch);
+    // Each sequence gets an equal share of the (unified) context
+    const llama_pos n_ctx_slot = static_cast<llama_pos>(llama_n_ctx(ctx_) / n_slots);
+    
+    // The single-sequence prefix cache does not survive multi-sequence decoding
+    reset_cache();
+    
+    std::vector<SequenceSlot> slots(n_slots);
+    std::vector<llama_token_data> candidates;
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+    
+    // Release samplers, batch and KV state however we leave this function
+    struct Cleanup {
+        std::vector<SequenceSlot>& slots;
+        llama_batch& batch;
+        InferenceEngine* engine;
+        ~Cleanup() {
+            for (auto& slot : slots) {
+                if (slot.sampler) {
+                    llama_sampler_free(slot.sampler);
+                }
+                if (slot.grammar) {
+                    llama_sampler_free(slot.grammar);
+                }
+            }
+            llama_batch_free(batch);
+            engine->reset_cache();
         }
+    } cleanup{slots, batch, this};
+    
+    for (int i = 0; i < n_slots; i++) {
+        slots[i].seq_id = i;
+        slots[i].sampler = llama_sampler_clone(sampler_);
+    }
+    
+    auto finish = [&](SequenceSlot& slot) {
+        llama_memory_seq_rm(mem, slot.seq_id, -1, -1);
+        slot.active = false;
+        slot.has_pending = false;
+        on_result(std::move(slot.result));
+    };
+    
+    bool input_exhausted = false;
+    while (true) {
+        // After cancel() the running sequences finish with an error and nothing new starts
+        input_exhausted = input_exhausted || cancel_requested_;
         
-        // Aggressive early stopping for concise responses
-        if (response.length() > 100) {
-            // Check for natural stopping points
-            char last_char = response.back();
-            if (last_char == '.' || last_char == '!' || last_char == '?') {
-                // If we have a complete sentence and enough content, stop
-                if (response.length() > 50) {
+        // Refill idle slots with the next prompts
+        for (auto& slot : slots) {
+            while (!slot.active && !input_exhausted) {
+                size_t index = 0;
+                std::vector<int> tokens;
+                if (!next_prompt(index, tokens)) {
+                    input_exhausted = true;
                     break;
                 }
+                slot.result = BatchResult();
+                slot.result.index = index;
+                slot.result.n_prompt_tokens = static_cast<int>(tokens.size());
+                if (tokens.empty() || static_cast<llama_pos>(tokens.size()) >= n_ctx_slot) {
+                    slot.result.ok = false;
+                    slot.result.error = tokens.empty() ? "Empty prompt" : "Prompt exceeds per-sequence context";
+                    on_result(std::move(slot.result));
+                    continue;
+                }
+                slot.prompt.assign(tokens.begin(), tokens.end());
+                slot.n_prefilled = 0;
+                slot.n_past = 0;
+                slot.has_pending = false;
+                slot.active = true;
+                llama_sampler_reset(slot.sampler);
+                if (slot.grammar) {
+                    llama_sampler_free(slot.grammar);
+                    slot.grammar = nullptr;
+                }
+                if (grammar_proto_) {
+                    slot.grammar = llama_sampler_clone(grammar_proto_);
+                }
+                llama_memory_seq_rm(mem, slot.seq_id, -1, -1);
             }
         }
         
-        // Check for repetitive patterns to prevent infinite loops
-        if (response.length() > 150) {
-            std::string last_50 = response.substr(response.length() - 50);
-            std::string prev_50 = response.substr(response.length() - 100, 50);
-            if (last_50 == prev_50) {
-                break;
+        bool any_active = false;
+        for (const auto& slot : slots) {
+            any_active = any_active || slot.active;
+        }
+        if (!any_active) {
+            break;
+        }
+        
+        // One pending token per generating sequence first, so decode latency stays
+        // flat while other slots are still prefilling
+        batch.n_tokens = 0;
+        for (auto& slot : slots) {
+            slot.i_batch = -1;
+            if (slot.active && slot.has_pending) {
+                slot.i_batch = batch.n_tokens;
+                batch_add(batch, slot.pending, slot.n_past++, slot.seq_id, true);
+                slot.has_pending = false;
+            }
+        }
+        // Fill the remaining batch capacity with prompt chunks
+        for (auto& slot : slots) {
+            while (slot.active && slot.n_prefilled < slot.prompt.size() && batch.n_tokens < n_batch) {
+                bool last = slot.n_prefilled + 1 == slot.prompt.size();
+                if (last) {
+                    slot.i_batch = batch.n_tokens;
+                }
+                batch_add(batch, slot.prompt[slot.n_prefilled++], slot.n_past++, slot.seq_id, last);
             }
         }
         
-        // Accept the token
-        llama_sampler_accept(sampler_, token);
+        if (llama_decode(ctx_, batch)) {
+            for (auto& slot : slots) {
+                if (slot.active) {
+                    slot.result.ok = false;
+                    slot.result.error = cancel_requested_ ? "Cancelled" : "Failed to decode batch";
+                    finish(slot);
+                }
+            }
+            continue;
+        }
         
-        // Prepare next batch
-        llama_batch next_batch = llama_batch_get_one(&token, 1);
-        {
-            const int n_ctx = llama_n_ctx(ctx_);
-            const int n_ctx_used = llama_memory_seq_pos_max(llama_get_memory(ctx_), 0);
-            if (n_ctx_used + next_batch.n_tokens > n_ctx) {
-                break;
+        // Sample the next token for every sequence that produced logits
+        for (auto& slot : slots) {
+            if (!slot.active || slot.i_batch < 0) {
+                continue;
+            }
+            llama_token token = sample_constrained(ctx_, slot.i_batch, slot.sampler, slot.grammar, candidates);
+            
+            std::string_view piece;
+            if (llama_vocab_is_eog(vocab, token) || !token_to_piece(token, piece)) {
+                finish(slot);
+                continue;
             }
+            slot.result.text.append(piece.data(), piece.size());
+            slot.result.n_generated_tokens++;
+            
+            if (slot.result.n_generated_tokens >= max_tokens || slot.n_past + 1 >= n_ctx_slot) {
+                finish(slot);
+                continue;
+            }
+            slot.pending = token;
+            slot.has_pending = true;
         }
-        if (llama_decode(ctx_, next_batch)) {
-            break;
+    }
+}
+
+// Sequences packed into one embeddings batch
+static const int kMaxPooledSequences = 64;
+
+static enum llama_pooling_type to_llama_pooling(PoolingType pooling) {
+    switch (pooling) {
+        case PoolingType::Mean: return LLAMA_POOLING_TYPE_MEAN;
+        case PoolingType::Cls:  return LLAMA_POOLING_TYPE_CLS;
+        case PoolingType::Last: return LLAMA_POOLING_TYPE_LAST;
+        case PoolingType::Rank: return LLAMA_POOLING_TYPE_RANK;
+        default:                return LLAMA_POOLING_TYPE_UNSPECIFIED;
+    }
+}
+
+llama_context* InferenceEngine::pooled_context(PoolingType pooling) {
+    if (pooled_ctx_ && pooled_type_ == pooling) {
+        return pooled_ctx_;
+    }
+    if (pooled_ctx_) {
+        llama_free(pooled_ctx_);
+        pooled_ctx_ = nullptr;
+    }
+    
+    // Non-causal encoders need a whole sequence inside one micro-batch, so the
+    // context, batch and micro-batch all share the same size
+    const int n_ctx_train = llama_model_n_ctx_train(model_);
+    const int n_tokens = config_.n_ctx > 0 ? config_.n_ctx : std::min(n_ctx_train > 0 ? n_ctx_train : 8192, 8192);
+    
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = n_tokens;
+    ctx_params.n_batch = n_tokens;
+    ctx_params.n_ubatch = n_tokens;
+    ctx_params.n_seq_max = kMaxPooledSequences;
+    ctx_params.kv_unified = true;
+    ctx_params.n_threads = config_.n_threads;
+    ctx_params.n_threads_batch = config_.n_threads_batch;
+    ctx_params.embeddings = true;
+    ctx_params.pooling_type = to_llama_pooling(pooling);
+    
+    pooled_ctx_ = llama_init_from_model(model_, ctx_params);
+    if (!pooled_ctx_) {
+        throw std::runtime_error("Failed to create embeddings context");
+    }
+    pooled_type_ = pooling;
+    
+    if (llama_pooling_type(pooled_ctx_) == LLAMA_POOLING_TYPE_NONE) {
+        throw std::runtime_error("Model does not define a pooling type; pass one explicitly");
+    }
+    return pooled_ctx_;
+}
+
+void InferenceEngine::run_pooled(llama_context* ctx, const std::vector<std::vector<int>>& inputs, int n_out, float* out) {
+    const int n_batch = static_cast<int>(llama_n_batch(ctx));
+    const int n_seq_max = std::min(kMaxPooledSequences, static_cast<int>(llama_n_seq_max(ctx)));
+    
+    // A sequence has to fit in one batch; a truncated input would still yield a
+    // plausible but wrong embedding or score, so refuse it before evaluating anything
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (inputs[i].size() > static_cast<size_t>(n_batch)) {
+            throw std::runtime_error("Input " + std::to_string(i) + " has " + std::to_string(inputs[i].size()) +
+                                     " tokens, more than the embeddings context holds (" +
+                                     std::to_string(n_batch) + ")");
         }
     }
     
-    return response;
+    // Encoder-only models (BERT style) go through llama_encode, everything else llama_decode
+    const bool encoder_only = llama_model_has_encoder(model_) && !llama_model_has_decoder(model_);
+    
+    struct BatchGuard {
+        llama_batch batch;
+        ~BatchGuard() { llama_batch_free(batch); }
+    } guard{llama_batch_init(n_batch, 0, 1)};
+    llama_batch& batch = guard.batch;
+    
+    size_t first = 0;   // input held by sequence 0 of the current batch
+    auto flush = [&](size_t end) {
+        if (batch.n_tokens == 0) {
+            return;
+        }
+        llama_memory_t mem = llama_get_memory(ctx);
+        if (mem) {
+            llama_memory_clear(mem, true);
+        }
+        if ((encoder_only ? llama_encode(ctx, batch) : llama_decode(ctx, batch)) != 0) {
+            throw std::runtime_error("Failed to evaluate embeddings batch");
+        }
+        for (size_t i = first; i < end; i++) {
+            const float* pooled = llama_get_embeddings_seq(ctx, static_cast<llama_seq_id>(i - first));
+            if (!pooled) {
+                throw std::runtime_error("Failed to get pooled embeddings");
+            }
+            std::copy(pooled, pooled + n_out, out + i * n_out);
+        }
+        batch.n_tokens = 0;
+        first = end;
+    };
+    
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const std::vector<int>& tokens = inputs[i];
+        const int n_tokens = static_cast<int>(tokens.size());
+        if (batch.n_tokens + n_tokens > n_batch || static_cast<int>(i - first) == n_seq_max) {
+            flush(i);
+        }
+        const llama_seq_id seq_id = static_cast<llama_seq_id>(i - first);
+        for (int j = 0; j < n_tokens; j++) {
+            batch_add(batch, tokens[j], j, seq_id, true);
+        }
+    }
+    flush(inputs.size());
+}
+
+EmbeddingMatrix InferenceEngine::embed(const std::vector<std::string>& texts, PoolingType pooling, bool normalize) {
+    if (!is_loaded()) {
+        throw std::runtime_error("Model not loaded");
+    }
+    if (pooling == PoolingType::Rank) {
+        throw std::runtime_error("Rank pooling produces scores, use rerank()");
+    }
+    
+    llama_context* ctx = pooled_context(pooling);
+    
+    std::vector<std::vector<int>> inputs;
+    inputs.reserve(texts.size());
+    for (const auto& text : texts) {
+        inputs.push_back(tokenize(text, true));
+        if (inputs.back().empty()) {
+            throw std::runtime_error("Cannot embed empty input");
+        }
+    }
+    
+    EmbeddingMatrix matrix;
+    matrix.rows = texts.size();
+    matrix.dim = static_cast<size_t>(llama_model_n_embd(model_));
+    matrix.data.resize(matrix.rows * matrix.dim);
+    run_pooled(ctx, inputs, static_cast<int>(matrix.dim), matrix.data.data());
+    
+    if (normalize) {
+        for (size_t i = 0; i < matrix.rows; i++) {
+            float* row = matrix.data.data() + i * matrix.dim;
+            double sum = 0.0;
+            for (size_t j = 0; j < matrix.dim; j++) {
+                sum += static_cast<double>(row[j]) * row[j];
+            }
+            const float scale = sum > 0.0 ? static_cast<float>(1.0 / std::sqrt(sum)) : 0.0f;
+            for (size_t j = 0; j < matrix.dim; j++) {
+                row[j] *= scale;
+            }
+        }
+    }
+    return matrix;
+}
+
+std::vector<int> InferenceEngine::rerank_tokens(const std::string& query, const std::string& document) {
+    // Rerankers that ship a prompt template (e.g. Qwen3-Reranker) take the pair
+    // through it; classic cross-encoders expect [BOS] query [EOS] [SEP] document [EOS]
+    const char* tmpl = llama_model_chat_template(model_, "rerank");
+    if (tmpl) {
+        std::string prompt = tmpl;
+        const std::pair<const char*, const std::string*> fields[] = {{"{query}", &query}, {"{document}", &document}};
+        for (const auto& field : fields) {
+            const size_t pos = prompt.find(field.first);
+            if (pos != std::string::npos) {
+                prompt.replace(pos, std::strlen(field.first), *field.second);
+            }
+        }
+        return tokenize(prompt, true);
+    }
+    
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    std::vector<int> tokens;
+    std::vector<int> query_tokens = tokenize(query, false);
+    std::vector<int> document_tokens = tokenize(document, false);
+    tokens.reserve(query_tokens.size() + document_tokens.size() + 4);
+    if (llama_vocab_bos(vocab) != LLAMA_TOKEN_NULL) {
+        tokens.push_back(llama_vocab_bos(vocab));
+    }
+    tokens.insert(tokens.end(), query_tokens.begin(), query_tokens.end());
+    tokens.push_back(llama_vocab_eos(vocab));
+    tokens.push_back(llama_vocab_sep(vocab));
+    tokens.insert(tokens.end(), document_tokens.begin(), document_tokens.end());
+    tokens.push_back(llama_vocab_eos(vocab));
+    return tokens;
+}
+
+std::vector<RerankResult> InferenceEngine::rerank(const std::string& query,
+                                                  const std::vector<std::string>& documents) {
+    if (!is_loaded()) {
+        throw std::runtime_error("Model not loaded");
+    }
+    
+    llama_context* ctx = pooled_context(PoolingType::Rank);
+    
+    std::vector<std::vector<int>> inputs;
+    inputs.reserve(documents.size());
+    for (const auto& document : documents) {
+        inputs.push_back(rerank_tokens(query, document));
+    }
+    
+    std::vector<float> scores(documents.size());
+    run_pooled(ctx, inputs, 1, scores.data());
+    
+    std::vector<RerankResult> results(documents.size());
+    for (size_t i = 0; i < documents.size(); i++) {
+        results[i].index = i;
+        results[i].score = scores[i];
+    }
+    std::stable_sort(results.begin(), results.end(), [](const RerankResult& a, const RerankResult& b) {
+        return a.score > b.score;
+    });
+    return results;
+}
+
+bool InferenceEngine::load_projector() {
+    if (mtmd_ctx_) {
+        return true;
+    }
+    if (!model_ || config_.mmproj_path.empty()) {
+        return false;
+    }
+    
+    mtmd_context_params params = mtmd_context_params_default();
+    params.use_gpu = config_.n_gpu_layers > 0;
+    params.print_timings = false;
+    params.n_threads = config_.n_threads_batch;
+    params.verbosity = GGML_LOG_LEVEL_ERROR;
+    
+    mtmd_ctx_ = mtmd_init_from_file(config_.mmproj_path.c_str(), model_, params);
+    if (!mtmd_ctx_) {
+        UI::print_warning("Failed to load vision projector: " + config_.mmproj_path);
+        return false;
+    }
+    if (!mtmd_support_vision(mtmd_ctx_)) {
+        UI::print_warning("Projector has no vision encoder: " + config_.mmproj_path);
+        mtmd_free(mtmd_ctx_);
+        mtmd_ctx_ = nullptr;
+        return false;
+    }
+    
+    // Embeddings depend on the projector and the text model it projects into
+    mmproj_fingerprint_ = tools::Hash::file_fingerprint(config_.mmproj_path);
+    if (!model_fingerprint_.empty()) {
+        mmproj_fingerprint_ = tools::Hash::to_hex(
+            tools::Hash::fnv1a64(model_fingerprint_.data(), model_fingerprint_.size(),
+                                 tools::Hash::fnv1a64(mmproj_fingerprint_.data(), mmproj_fingerprint_.size())));
+    }
+    return true;
+}
+
+std::string InferenceEngine::image_cache_path(uint64_t image_hash) const {
+    std::string dir = config_.image_cache_dir;
+    if (dir.empty()) {
+        std::string cache_dir = tools::FileOps::join_path(tools::FileOps::join_path(tools::FileOps::get_home_dir(), ".delta-cli"), "cache");
+        dir = tools::FileOps::join_path(cache_dir, "image_embeddings");
+    }
+    return tools::FileOps::join_path(dir, mmproj_fingerprint_ + "-" + tools::Hash::to_hex(image_hash) + ".bin");
+}
+
+// Cache file layout: magic, token count, embedding width, then the float matrix
+static const uint32_t kImageCacheMagic = 0x474d4944; // "DIMG"
+
+bool InferenceEngine::encode_image(const mtmd_input_chunk* chunk, uint64_t image_hash, std::vector<float>& embd) {
+    const uint32_t n_tokens = static_cast<uint32_t>(mtmd_input_chunk_get_n_tokens(chunk));
+    const uint32_t n_embd = static_cast<uint32_t>(llama_model_n_embd_inp(model_));
+    const size_t n_floats = static_cast<size_t>(n_tokens) * n_embd;
+    const std::string path = image_cache_path(image_hash);
+    
+    if (!mmproj_fingerprint_.empty()) {
+        std::ifstream in(path, std::ios::binary);
+        uint32_t header[3] = {0, 0, 0};
+        if (in.read(reinterpret_cast<char*>(header), sizeof(header)) &&
+            header[0] == kImageCacheMagic && header[1] == n_tokens && header[2] == n_embd) {
+            embd.resize(n_floats);
+            if (in.read(reinterpret_cast<char*>(embd.data()), static_cast<std::streamsize>(n_floats * sizeof(float)))) {
+                last_stats_.n_image_cache_hits++;
+                return true;
+            }
+        }
+    }
+    
+    if (mtmd_encode_chunk(mtmd_ctx_, chunk) != 0) {
+        return false;
+    }
+    const float* out = mtmd_get_output_embd(mtmd_ctx_);
+    embd.assign(out, out + n_floats);
+    
+    // Best effort: a failed write only costs a re-encode next time
+    if (!mmproj_fingerprint_.empty()) {
+        const std::string dir = path.substr(0, path.find_last_of("/\\"));
+        tools::FileOps::create_dir(dir.substr(0, dir.find_last_of("/\\")));
+        tools::FileOps::create_dir(dir);
+        const std::string temp_path = path + ".tmp";
+        std::ofstream file(temp_path, std::ios::binary);
+        const uint32_t header[3] = {kImageCacheMagic, n_tokens, n_embd};
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(embd.data()), static_cast<std::streamsize>(n_floats * sizeof(float)));
+        file.close();
+        if (file.good()) {
+            std::remove(path.c_str());
+            std::rename(temp_path.c_str(), path.c_str());
+        } else {
+            std::remove(temp_path.c_str());
+        }
+    }
+    return true;
 }
 
 std::string InferenceEngine::generate_multimodal(const std::string& prompt,
                                                  const std::vector<std::string>& image_paths,
                                                  int max_tokens,
                                                  bool stream) {
-    (void)image_paths; // Suppress unused parameter warning
-    // For now, just generate text without image processing
-    // This can be extended later for true multimodal support
-    return generate(prompt, max_tokens, stream);
+    EchoStringTokenSink sink(stream);
+    generate_multimodal(prompt, image_paths, max_tokens, sink);
+    return sink.take();
+}
+
+void InferenceEngine::generate_multimodal(const std::string& prompt,
+                                          const std::vector<std::string>& image_paths,
+                                          int max_tokens,
+                                          TokenSink& sink) {
+    if (!is_loaded()) {
+        throw std::runtime_error("Model not loaded");
+    }
+    if (image_paths.empty()) {
+        generate(prompt, max_tokens, sink);
+        return;
+    }
+    if (!load_projector()) {
+        throw std::runtime_error("No vision projector for this model (use --mmproj <file>)");
+    }
+    
+    auto t_start = std::chrono::steady_clock::now();
+    
+    // The content hash both names the bitmap and keys its cached embeddings
+    std::vector<std::unique_ptr<mtmd_bitmap, decltype(&mtmd_bitmap_free)>> bitmaps;
+    std::vector<const mtmd_bitmap*> bitmap_ptrs;
+    std::vector<uint64_t> image_hashes;
+    for (const auto& path : image_paths) {
+        std::string data = tools::FileOps::read_file(path);
+        if (data.empty()) {
+            throw std::runtime_error("Cannot read image: " + path);
+        }
+        mtmd_bitmap* bitmap = mtmd_helper_bitmap_init_from_buf(
+            mtmd_ctx_, reinterpret_cast<const unsigned char*>(data.data()), data.size());
+        if (!bitmap) {
+            throw std::runtime_error("Unsupported image format: " + path);
+        }
+        bitmaps.emplace_back(bitmap, mtmd_bitmap_free);
+        bitmap_ptrs.push_back(bitmap);
+        image_hashes.push_back(tools::Hash::fnv1a64(data.data(), data.size()));
+        mtmd_bitmap_set_id(bitmap, tools::Hash::to_hex(image_hashes.back()).c_str());
+    }
+    
+    // Images go where the prompt has media markers, or in front of the text
+    std::string text = prompt;
+    const std::string marker = mtmd_default_marker();
+    if (text.find(marker) == std::string::npos) {
+        std::string markers;
+        for (size_t i = 0; i < image_paths.size(); i++) {
+            markers += marker;
+        }
+        text = markers + "\n" + text;
+    }
+    
+    std::unique_ptr<mtmd_input_chunks, decltype(&mtmd_input_chunks_free)> chunks(mtmd_input_chunks_init(),
+                                                                                 mtmd_input_chunks_free);
+    mtmd_input_text input;
+    input.text = text.c_str();
+    input.add_special = true;
+    input.parse_special = true;
+    if (mtmd_tokenize(mtmd_ctx_, chunks.get(), &input, bitmap_ptrs.data(), bitmap_ptrs.size()) != 0) {
+        throw std::runtime_error("Failed to tokenize multimodal prompt");
+    }
+    
+    const size_t n_chunks = mtmd_input_chunks_size(chunks.get());
+    const int n_ctx = llama_n_ctx(ctx_);
+    size_t n_tokens_total = 0;
+    for (size_t i = 0; i < n_chunks; i++) {
+        const mtmd_input_chunk* chunk = mtmd_input_chunks_get(chunks.get(), i);
+        n_tokens_total += mtmd_input_chunk_get_n_tokens(chunk);
+    }
+    if (n_tokens_total >= static_cast<size_t>(n_ctx)) {
+        throw std::runtime_error("Context size exceeded while submitting prompt");
+    }
+    
+    // Image positions never match a text prompt, so multimodal prompts start from
+    // an empty cache; cached_tokens_ gets a placeholder for every image position
+    CancelScope cancel_scope(cancel_requested_);
+    reset_cache();
+    llama_sampler_reset(sampler_);
+    reset_grammar();
+    last_stats_ = GenerationStats();
+    last_stats_.n_prompt_tokens = static_cast<int>(n_tokens_total);
+    last_stats_.n_images = static_cast<int>(image_paths.size());
+    
+    auto t_prefill = std::chrono::steady_clock::now();
+    const int n_batch = std::min(scratch_->capacity, static_cast<int32_t>(llama_n_batch(ctx_)));
+    llama_batch& batch = scratch_->batch;
+    std::vector<float> embd;
+    size_t i_image = 0;
+    size_t n_done = 0;
+    auto finish_cancelled = [&]() {
+        discard_aborted_decode();
+        last_stats_.prefill_ms = elapsed_ms(t_prefill);
+        last_stats_.cancelled = true;
+        sink.on_finish();
+    };
+    for (size_t i = 0; i < n_chunks; i++) {
+        const mtmd_input_chunk* chunk = mtmd_input_chunks_get(chunks.get(), i);
+        const llama_pos n_past = static_cast<llama_pos>(cached_tokens_.size());
+        
+        if (mtmd_input_chunk_get_type(chunk) == MTMD_INPUT_CHUNK_TYPE_TEXT) {
+            size_t n_tokens = 0;
+            const llama_token* tokens = mtmd_input_chunk_get_tokens_text(chunk, &n_tokens);
+            for (size_t j = 0; j < n_tokens; ) {
+                const size_t n_step = std::min(static_cast<size_t>(n_batch), n_tokens - j);
+                batch.n_tokens = 0;
+                for (size_t k = 0; k < n_step; k++) {
+                    batch_add(batch, tokens[j + k], static_cast<llama_pos>(cached_tokens_.size() + k), 0,
+                              i + 1 == n_chunks && j + k + 1 == n_tokens);
+                }
+                if (llama_decode(ctx_, batch)) {
+                    if (cancel_requested_) {
+                        finish_cancelled();
+                        return;
+                    }
+                    reset_cache();
+                    throw std::runtime_error("Failed to evaluate prompt");
+                }
+                cached_tokens_.insert(cached_tokens_.end(), tokens + j, tokens + j + n_step);
+                j += n_step;
+            }
+        } else if (mtmd_input_chunk_get_type(chunk) == MTMD_INPUT_CHUNK_TYPE_IMAGE) {
+            if (i_image >= image_hashes.size() || !encode_image(chunk, image_hashes[i_image++], embd)) {
+                reset_cache();
+                throw std::runtime_error("Failed to encode image");
+            }
+            llama_pos new_n_past = n_past;
+            if (mtmd_helper_decode_image_chunk(mtmd_ctx_, ctx_, chunk, embd.data(), n_past, 0, n_batch, &new_n_past) != 0) {
+                if (cancel_requested_) {
+                    finish_cancelled();
+                    return;
+                }
+                reset_cache();
+                throw std::runtime_error("Failed to evaluate image");
+            }
+            cached_tokens_.resize(static_cast<size_t>(new_n_past), LLAMA_TOKEN_NULL);
+        }
+        
+        n_done += mtmd_input_chunk_get_n_tokens(chunk);
+        const double ms = elapsed_ms(t_prefill);
+        const double tokens_per_sec = ms > 0.0 ? n_done * 1000.0 / ms : 0.0;
+        if ((!sink.on_prefill_progress(static_cast<int>(n_done), static_cast<int>(n_tokens_total), tokens_per_sec) ||
+             cancel_requested_) && n_done < n_tokens_total) {
+            last_stats_.prefill_ms = ms;
+            last_stats_.cancelled = true;
+            sink.on_finish();
+            return;
+        }
+    }
+    last_stats_.prefill_ms = elapsed_ms(t_prefill);
+    
+    // The draft model never saw the image, so decode without speculation
+    generate_tokens(max_tokens, sink, t_start, false);
+}
+
+
+EnginePool::Lease::Lease(Lease&& other) noexcept : pool_(other.pool_), engine_(other.engine_) {
+    other.pool_ = nullptr;
+    other.engine_ = nullptr;
+}
+
+EnginePool::Lease& EnginePool::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        engine_ = other.engine_;
+        other.pool_ = nullptr;
+        other.engine_ = nullptr;
+    }
+    return *this;
+}
+
+void EnginePool::Lease::release() {
+    if (pool_ && engine_) {
+        pool_->give_back(engine_);
+    }
+    pool_ = nullptr;
+    engine_ = nullptr;
+}
+
+EnginePool::~EnginePool() {
+    // Contexts first, then the shared weights
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.clear();
+    engines_.clear();
 }
 
+bool EnginePool::load(const InferenceConfig& config, size_t max_engines) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (engines_.size() != idle_.size() || n_creating_ > 0) {
+            throw std::runtime_error("Cannot reload an engine pool with engines in use");
+        }
+        idle_.clear();
+        engines_.clear();
+    }
+    
+    model_ = ModelHandle::load(config.model_path, config);
+    if (!model_) {
+        UI::print_error("Failed to load model: " + config.model_path);
+        return false;
+    }
+    draft_model_.reset();
+    if (!config.draft_model_path.empty()) {
+        draft_model_ = ModelHandle::load(config.draft_model_path, config);
+        if (!draft_model_) {
+            UI::print_warning("Failed to load draft model: " + config.draft_model_path);
+        }
+    }
+    
+    config_ = config;
+    max_engines_ = std::max<size_t>(1, max_engines);
+    return true;
+}
+
+size_t EnginePool::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return engines_.size();
+}
+
+EnginePool::Lease EnginePool::acquire() {
+    return take(true);
+}
+
+EnginePool::Lease EnginePool::try_acquire() {
+    return take(false);
+}
+
+EnginePool::Lease EnginePool::take(bool wait) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!model_) {
+        throw std::runtime_error("Model not loaded");
+    }
+    
+    auto can_proceed = [this] { return !idle_.empty() || engines_.size() + n_creating_ < max_engines_; };
+    if (!can_proceed()) {
+        if (!wait) {
+            return Lease();
+        }
+        available_.wait(lock, can_proceed);
+    }
+    
+    if (!idle_.empty()) {
+        InferenceEngine* engine = idle_.back();
+        idle_.pop_back();
+        return Lease(this, engine);
+    }
+    
+    // Creating a context allocates its KV cache; do it without holding the lock
+    n_creating_++;
+    lock.unlock();
+    std::unique_ptr<InferenceEngine> engine(new InferenceEngine());
+    InferenceConfig config = config_;
+    config.draft_model_path = draft_model_ ? draft_model_->path() : "";
+    const bool loaded = engine->load_model(model_, config, draft_model_);
+    lock.lock();
+    n_creating_--;
+    
+    if (!loaded) {
+        available_.notify_one();
+        throw std::runtime_error("Failed to create context");
+    }
+    InferenceEngine* raw = engine.get();
+    engines_.push_back(std::move(engine));
+    return Lease(this, raw);
+}
+
+void EnginePool::give_back(InferenceEngine* engine) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_.push_back(engine);
+    }
+    available_.notify_one();
+}
 
 
 } // namespace delta
\ No newline at end of file
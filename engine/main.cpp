@@ -7,12 +7,15 @@
 #include "update.h"
 #include "commands.h"
 #include "history.h"
+#include <nlohmann/json.hpp>
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <cstring>
 #include <iomanip>
 #include <sstream>
 #include <thread>
+#include <atomic>
 #include <chrono>
 #ifdef _WIN32
 #include <windows.h>
@@ -36,6 +39,9 @@
 
 using namespace delta;
 
+// Engine producing a response in interactive mode; Ctrl+C cancels just that response
+static std::atomic<InferenceEngine*> g_generating_engine{nullptr};
+
 #ifndef _WIN32
 // Flag set by signal handler so interactive loop can exit and stop llama-server
 static volatile sig_atomic_t g_exit_requested = 0;
@@ -43,6 +49,24 @@ static volatile sig_atomic_t g_exit_requested = 0;
 static void exit_signal_handler(int) {
     g_exit_requested = 1;
 }
+
+static void interrupt_signal_handler(int sig) {
+    InferenceEngine* engine = g_generating_engine.load();
+    if (engine) {
+        engine->cancel();
+    } else {
+        exit_signal_handler(sig);
+    }
+}
+#else
+static BOOL WINAPI console_ctrl_handler(DWORD type) {
+    InferenceEngine* engine = g_generating_engine.load();
+    if (type == CTRL_C_EVENT && engine) {
+        engine->cancel();
+        return TRUE;
+    }
+    return FALSE;
+}
 #endif
 
 // Command handlers
@@ -70,8 +94,10 @@ USAGE:
     delta --server              Start server with Web UI (recommended)
     delta                       Start interactive terminal mode
     delta [OPTIONS] [PROMPT]    One-shot query
-    delta pull <model-name>     Download a model
+    delta pull <model-name>...  Download one or more models (several run concurrently)
     delta remove <model-name>   Remove a model
+    delta rerank -m <MODEL>     Rerank JSONL queries from stdin (see RERANK)
+    delta batch -m <MODEL>      Answer JSONL prompts with one model load (see BATCH)
 
 SERVER OPTIONS (delta --server):
     -m, --model <MODEL>         Specify model (auto-selects if omitted)
@@ -81,7 +107,9 @@ SERVER OPTIONS (delta --server):
     --models-dir <DIR>          Scan directory for .gguf models
     --embedding                 Enable embedding endpoints
     --reranking                 Enable reranking endpoints
-    --md <model>                Draft model for speculative decoding
+    --md <model>                Draft model for speculative decoding (server and CLI)
+    --lookup-ngram <N>          Speculate without a draft model by matching the last N
+                                tokens against the prompt and output (CLI, e.g. 3)
 
 CLI OPTIONS:
     -h, --help                  Show this help message
@@ -92,15 +120,50 @@ CLI OPTIONS:
     -T, --temperature <F>       Sampling temperature (default: 0.8)
     -c, --ctx-size <N>          Context size (default: 2048)
     -g, --gpu-layers <N>        GPU layers (default: 0, use -1 for all)
+    -th, --threads <N>          Generation threads (default: physical cores)
+    -tb, --threads-batch <N>    Prompt processing threads (default: logical cores)
+    --numa <MODE>               NUMA policy: distribute, isolate, numactl (default: off)
+    -ctk, --cache-type-k <T>    KV cache type for K: f16, q8_0, q4_0 (default: f16)
+    -ctv, --cache-type-v <T>    KV cache type for V: f16, q8_0, q4_0 (needs flash attention)
+    -fa, --flash-attn <MODE>    Flash attention: on, off, auto (default: auto)
+    --no-warmup                 Skip weight prefetch and the warm-up decode at load
+    --context-shift             Drop old context instead of stopping when it is full
+    --keep <N>                  Tokens kept at the start when shifting (default: 4)
     --multimodal                Enable multimodal mode (images + text)
+    --mmproj <file>             Vision projector (default: the one pulled with the model)
+    --image <file>              Attach an image to the prompt (repeatable)
     --interactive               Start interactive chat mode
-    --grammar-file <file>       Grammar file for output constraints
+    --grammar-file <file>       GBNF grammar the output must match
+    --json-schema <schema>      JSON schema the output must match (file or inline JSON)
     --check-updates             Check for new versions
     --update                    Update to latest version
     --no-color                  Disable colored output
 
+RERANK (delta rerank):
+    Reads one JSON object per line: {"query": "...", "documents": ["...", ...]}
+    Writes one line per query: {"results": [{"index": N, "score": F}, ...]}
+    An "id" field in the input is copied to the output.
+    --input <file>              Read queries from a file instead of stdin
+    --top-n <N>                 Only output the N best documents per query
+
+BATCH (delta batch):
+    Reads one JSON object per line: {"prompt": "..."}
+    Writes one line per prompt as soon as it finishes (completion order):
+    {"index": N, "text": "...", "n_prompt_tokens": N, "n_generated_tokens": N}
+    An "id" field in the input is copied to the output. Ctrl+C stops early.
+    --input <file>              Read prompts from a file instead of stdin
+    --output <file>             Write results to a file instead of stdout
+    --parallel <N>              Sequences decoded together (default: 4)
+    -c is the context per sequence (default: training context, at most 8192);
+    -t limits tokens per response.
+
+PULL (delta pull):
+    --max-downloads <N>         Models downloaded at once (default: 3)
+    --connections <N>           Connections per large model file (default: 4, 1 = single stream)
+
 EXAMPLES:
     delta pull qwen2.5:0.5b              # Download a model
+    delta pull qwen3:0.6b llama3.2:1b     # Download several models concurrently
     delta --server                        # Start with auto-selected model
     delta --server -m llama3.1:8b         # Start with specific model
     delta --server --port 9090            # Use custom port
@@ -119,6 +182,33 @@ void print_version() {
     std::cout << "Professional offline AI assistant" << std::endl;
 }
 
+// Interactive prompt: the session's earlier turns and the new input through the model's
+// chat template. Each turn then extends the previous prompt, so the KV cache (and the
+// session snapshot restored on start, /use and /switch) covers everything but the new
+// turn. The oldest turns are dropped once the conversation no longer fits next to the
+// reply. Models without a chat template get the bare input, as before.
+static std::string build_chat_prompt(InferenceEngine& engine, const std::vector<HistoryEntry>& turns,
+                                     const std::string& input, int max_tokens) {
+    const int budget = engine.get_context_size() - max_tokens;
+    for (size_t first = 0; first <= turns.size(); first++) {
+        std::vector<ChatMessage> messages;
+        for (size_t i = first; i < turns.size(); i++) {
+            messages.push_back({"user", turns[i].user_message});
+            messages.push_back({"assistant", turns[i].ai_response});
+        }
+        messages.push_back({"user", input});
+        
+        std::string prompt = engine.format_chat(messages);
+        if (prompt.empty()) {
+            return input;
+        }
+        if (first == turns.size() || static_cast<int>(engine.tokenize(prompt).size()) <= budget) {
+            return prompt;
+        }
+    }
+    return input;
+}
+
 void interactive_mode(InferenceEngine& engine, InferenceConfig& config, ModelManager& model_mgr,
                       const std::string& current_model) {
     // Initialize command system
@@ -194,6 +284,9 @@ void interactive_mode(InferenceEngine& engine, InferenceConfig& config, ModelMan
         }
     }
 
+    // Resume from the session's saved KV cache when it was taken with this model
+    engine.load_session_state(history_mgr.get_session_dir());
+
     // Show session info only if not default (to avoid duplicate messages)
     std::string current_session_name = history_mgr.get_current_session_name();
     if (!history_mgr.is_default_session_active()) {
@@ -202,9 +295,6 @@ void interactive_mode(InferenceEngine& engine, InferenceConfig& config, ModelMan
 
     std::cout << std::endl;
 
-    // Do not accumulate or inject prior turns into prompts; rely on clean llama context per turn
-    std::vector<std::string> history;
-
 #ifndef _WIN32
     // Register signal handlers so closing terminal or Ctrl+C stops llama-server
     struct sigaction sa;
@@ -213,7 +303,10 @@ void interactive_mode(InferenceEngine& engine, InferenceConfig& config, ModelMan
     sa.sa_flags = 0; // No SA_RESTART so get_input() can return on signal
     sigaction(SIGTERM, &sa, nullptr);
     sigaction(SIGHUP, &sa, nullptr);
+    sa.sa_handler = interrupt_signal_handler;
     sigaction(SIGINT, &sa, nullptr);
+#else
+    SetConsoleCtrlHandler(console_ctrl_handler, TRUE);
 #endif
 
     while (true) {
@@ -275,20 +368,27 @@ void interactive_mode(InferenceEngine& engine, InferenceConfig& config, ModelMan
             continue;
         }
 
-        // Build prompt with only the current user input
-        history.push_back(input);
-
         // Generate response using session settings
         try {
             std::cout << "\n";
 
-            // Use clean prompt without modifications
-            std::string simple_prompt = input;
-
             // Generate response with real-time streaming
             // Use very short max_tokens for concise responses
             int max_tokens = std::min(session.max_tokens, 50);
-            std::string response = engine.generate(simple_prompt, max_tokens, true);
+            std::string prompt = build_chat_prompt(engine, history_mgr.get_history(), input, max_tokens);
+            g_generating_engine.store(&engine);
+            std::string response;
+            try {
+                response = engine.generate(prompt, max_tokens, true);
+            } catch (...) {
+                g_generating_engine.store(nullptr);
+                throw;
+            }
+            g_generating_engine.store(nullptr);
+            if (engine.get_last_stats().cancelled) {
+                std::cout << "\n";
+                UI::print_info("Generation cancelled");
+            }
 
             // Clean up the response
             response.erase(0, response.find_first_not_of(" \t\n\r"));
@@ -299,17 +399,123 @@ void interactive_mode(InferenceEngine& engine, InferenceConfig& config, ModelMan
 
             std::cout << "\n" << std::endl;
 
-            // Save to history (no injection back into prompt state)
+            // Save to history; the next prompt replays it through the chat template
             history_mgr.add_entry(input, response, session.current_model);
         } catch (const std::exception& e) {
             UI::print_error(std::string("Error generating response: ") + e.what());
         }
     }
 
+    // Snapshot the KV cache so resuming this session later skips the prefill
+    engine.save_session_state(history_mgr.get_session_dir());
+
     // Unload model and stop llama-server when leaving interactive mode (exit, quit, eof, or signal)
     Commands::stop_llama_server();
 }
 
+// delta batch: answer JSONL prompts with one model load, decoding several sequences
+// together. Each result is written as soon as its sequence finishes.
+int run_batch(InferenceEngine& engine, std::istream& in, std::ostream& out, int max_tokens) {
+    using json = nlohmann::json;
+    std::map<size_t, json> running;     // output lines waiting for their result, by index
+    size_t n_prompts = 0;
+    size_t n_failed = 0;
+    long long n_prompt_tokens = 0;
+    long long n_generated_tokens = 0;
+    auto write = [&](const json& response) {
+        out << response.dump() << '\n';
+        out.flush();
+    };
+
+    auto t_start = std::chrono::steady_clock::now();
+    std::string line;
+    engine.generate_batch(
+        [&](size_t& index, std::vector<int>& tokens) {
+            while (std::getline(in, line)) {
+                if (line.find_first_not_of(" \t\r") == std::string::npos)
+                    continue;
+
+                json response;
+                response["index"] = n_prompts;
+                try {
+                    json request = json::parse(line);
+                    if (request.contains("id"))
+                        response["id"] = request["id"];
+                    tokens = engine.tokenize(request.at("prompt").get<std::string>(), true);
+                } catch (const std::exception& e) {
+                    response["error"] = e.what();
+                    write(response);
+                    n_prompts++;
+                    n_failed++;
+                    continue;
+                }
+                index = n_prompts++;
+                running[index] = std::move(response);
+                return true;
+            }
+            return false;
+        },
+        [&](BatchResult&& result) {
+            json response = std::move(running[result.index]);
+            running.erase(result.index);
+            n_prompt_tokens += result.n_prompt_tokens;
+            n_generated_tokens += result.n_generated_tokens;
+            if (result.ok) {
+                response["text"] = std::move(result.text);
+                response["n_prompt_tokens"] = result.n_prompt_tokens;
+                response["n_generated_tokens"] = result.n_generated_tokens;
+            } else {
+                response["error"] = result.error;
+                n_failed++;
+            }
+            write(response);
+        },
+        max_tokens);
+
+    // Results may go to stdout, so the report goes to stderr
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    const double rate = seconds > 0.0 ? 1.0 / seconds : 0.0;
+    std::cerr << std::fixed << std::setprecision(1)
+              << "Batch: " << n_prompts << " prompts (" << n_failed << " failed) in " << seconds << " s\n"
+              << "  prompt:    " << n_prompt_tokens << " tokens (" << n_prompt_tokens * rate << " tok/s)\n"
+              << "  generated: " << n_generated_tokens << " tokens (" << n_generated_tokens * rate << " tok/s)\n"
+              << "  " << std::setprecision(2) << n_prompts * rate << " prompts/s" << std::endl;
+    return n_failed == 0 ? 0 : 1;
+}
+
+// delta rerank: score JSONL queries with a reranker model, one output line per input line
+int run_rerank(InferenceEngine& engine, std::istream& in, int top_n) {
+    using json = nlohmann::json;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        json response;
+        try {
+            json request = json::parse(line);
+            if (request.contains("id"))
+                response["id"] = request["id"];
+            std::string query = request.at("query").get<std::string>();
+            std::vector<std::string> documents = request.at("documents").get<std::vector<std::string>>();
+
+            auto results = engine.rerank(query, documents);
+            if (top_n > 0 && results.size() > static_cast<size_t>(top_n))
+                results.resize(top_n);
+
+            json items = json::array();
+            for (const auto& result : results) {
+                items.push_back({{"index", result.index}, {"score", result.score}});
+            }
+            response["results"] = std::move(items);
+        } catch (const std::exception& e) {
+            response["error"] = e.what();
+        }
+        std::cout << response.dump() << std::endl;
+    }
+    return 0;
+}
+
 void list_models(ModelManager& model_mgr, bool show_available = false) {
     // Get friendly model list with new structured format
     auto models = model_mgr.get_friendly_model_list(show_available);
@@ -362,36 +568,51 @@ void list_models(ModelManager& model_mgr, bool show_available = false) {
     }
 }
 
-// Progress bar for model downloads (ASCII on Windows to avoid garbled output)
+// Progress bar for model downloads
 void download_progress_callback(double progress, long long current, long long total) {
-    double current_mb = current / (1024.0 * 1024.0);
-    double total_mb = total / (1024.0 * 1024.0);
-    int bar_width = 50;
-    int pos = (int)(progress / 100.0 * bar_width);
-    std::cout << "\r  [";
-#ifdef _WIN32
-    for (int i = 0; i < bar_width; i++) {
-        if (i < pos)
-            std::cout << "#";
-        else if (i == pos)
-            std::cout << ">";
-        else
-            std::cout << "-";
+    UI::print_download_progress(progress, current, total);
+}
+
+// Download several models through the scheduler, showing one combined progress line
+int run_pull(ModelManager& model_mgr, const std::vector<std::string>& model_names, int max_downloads) {
+    DownloadScheduler scheduler(model_mgr, static_cast<size_t>(max_downloads));
+    std::vector<std::shared_ptr<DownloadJob>> jobs;
+    for (const auto& name : model_names) {
+        jobs.push_back(scheduler.submit(name));
     }
-#else
-    for (int i = 0; i < bar_width; i++) {
-        if (i < pos)
-            std::cout << "█";
-        else if (i == pos)
-            std::cout << "▓";
-        else
-            std::cout << "░";
+
+    // Byte totals are only known once each transfer has started, so the bar is approximate early on
+    for (;;) {
+        size_t done = 0;
+        long long current = 0;
+        long long total = 0;
+        for (const auto& job : jobs) {
+            done += job->finished() ? 1 : 0;
+            current += job->current_bytes();
+            total += job->total_bytes();
+        }
+        if (done == jobs.size()) {
+            break;
+        }
+        if (total > 0) {
+            std::string label = "[" + std::to_string(done) + "/" + std::to_string(jobs.size()) + " models]";
+            UI::print_download_progress(100.0 * current / total, current, total, label);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
-#endif
-    std::cout << "] " << std::fixed << std::setprecision(1) << progress << "% ";
-    std::cout << "(" << std::fixed << std::setprecision(1) << current_mb << " / ";
-    std::cout << total_mb << " MB)";
-    std::cout << std::flush;
+    scheduler.wait_all();
+    std::cout << std::endl;
+
+    int failed = 0;
+    for (const auto& job : jobs) {
+        if (job->state() == DownloadJob::State::Completed) {
+            UI::print_success("Ready: " + job->model_name());
+        } else {
+            UI::print_error("Not downloaded: " + job->model_name());
+            failed++;
+        }
+    }
+    return failed == 0 ? 0 : 1;
 }
 
 int main(int argc, char** argv) {
@@ -404,7 +625,9 @@ int main(int argc, char** argv) {
     InferenceConfig config;
     std::string model_name = "";
     std::string prompt = "";
-    std::string pull_model_name = "";
+    std::vector<std::string> pull_model_names;
+    int max_downloads = static_cast<int>(DownloadScheduler::kDefaultMaxConcurrent);
+    int download_connections = ModelManager::kDefaultDownloadConnections;
     std::string remove_model_name = "";
     bool interactive = false;
     bool show_help = false;
@@ -416,6 +639,12 @@ int main(int argc, char** argv) {
     bool do_update = false;
     bool is_pull_command = false;
     bool is_remove_command = false;
+    bool is_rerank_command = false;
+    bool is_batch_command = false;
+    std::string input_file = "";
+    std::string output_file = "";
+    int batch_parallel = 4;
+    int top_n = 0;
     bool no_args = (argc == 1); // No arguments provided
     int max_tokens = 256;
     int server_port = 8080;
@@ -423,18 +652,17 @@ int main(int argc, char** argv) {
     int max_context = 0;               // 0 = use model default from registry when launching server
     bool max_context_explicit = false; // Track if --c was explicitly set
     std::string models_dir = "";       // Router mode: scan this dir for .gguf (no -m)
+    std::string draft_model = "";      // --md: speculative decoding (server and CLI)
+    std::vector<std::string> image_paths;  // --image: attach images to a single prompt
     // Server-only flags (parsed for compatibility; unused in CLI mode)
     bool enable_embedding = false;
     bool enable_reranking = false;
-    std::string draft_model = "";
     std::string grammar_file = "";
+    std::string json_schema = "";      // --json-schema: file path or inline JSON (CLI only)
 
     // Check for pull command first
     if (argc > 1 && std::string(argv[1]) == "pull") {
-        is_pull_command = true;
-        if (argc > 2) {
-            pull_model_name = argv[2];
-        }
+        is_pull_command = true;   // model names are collected with the other arguments below
     }
 
     // Check for remove command
@@ -445,10 +673,22 @@ int main(int argc, char** argv) {
         }
     }
 
+    // Check for rerank command
+    if (argc > 1 && std::string(argv[1]) == "rerank") {
+        is_rerank_command = true;
+    }
+
+    // Check for batch command
+    if (argc > 1 && std::string(argv[1]) == "batch") {
+        is_batch_command = true;
+    }
+
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
 
-        if (arg == "-h" || arg == "--help") {
+        if (i == 1 && (is_rerank_command || is_batch_command)) {
+            continue;
+        } else if (arg == "-h" || arg == "--help") {
             show_help = true;
         } else if (arg == "-v" || arg == "--version") {
             show_version = true;
@@ -498,10 +738,14 @@ int main(int argc, char** argv) {
             enable_embedding = true;
         } else if (arg == "--reranking") {
             enable_reranking = true;
+        } else if (arg == "--lookup-ngram" && i + 1 < argc) {
+            config.lookup_ngram = std::max(0, std::atoi(argv[++i]));
         } else if (arg == "--md" && i + 1 < argc) {
             draft_model = argv[++i];
         } else if (arg == "--grammar-file" && i + 1 < argc) {
             grammar_file = argv[++i];
+        } else if (arg == "--json-schema" && i + 1 < argc) {
+            json_schema = argv[++i];
         } else if (arg == "--models-dir" && i + 1 < argc) {
             models_dir = argv[++i];
         } else if (arg == "--check-updates") {
@@ -510,6 +754,11 @@ int main(int argc, char** argv) {
             do_update = true;
         } else if (arg == "--multimodal") {
             config.multimodal = true;
+        } else if (arg == "--mmproj" && i + 1 < argc) {
+            config.mmproj_path = argv[++i];
+        } else if (arg == "--image" && i + 1 < argc) {
+            image_paths.push_back(argv[++i]);
+            config.multimodal = true;
         } else if (arg == "--no-color") {
             // Disable color (would set a global flag in UI class)
         } else if (arg == "-m" || arg == "--model") {
@@ -532,9 +781,73 @@ int main(int argc, char** argv) {
             if (i + 1 < argc) {
                 config.n_gpu_layers = std::atoi(argv[++i]);
             }
-        } else if (arg == "pull") {
+        } else if (arg == "--input" && i + 1 < argc) {
+            input_file = argv[++i];
+        } else if (arg == "--top-n" && i + 1 < argc) {
+            top_n = std::atoi(argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            output_file = argv[++i];
+        } else if (arg == "--parallel" && i + 1 < argc) {
+            batch_parallel = std::atoi(argv[++i]);
+            if (batch_parallel < 1) {
+                UI::print_error("--parallel must be at least 1");
+                return 1;
+            }
+        } else if (arg == "--max-downloads" && i + 1 < argc) {
+            max_downloads = std::atoi(argv[++i]);
+            if (max_downloads < 1) {
+                UI::print_error("--max-downloads must be at least 1");
+                return 1;
+            }
+        } else if (arg == "--connections" && i + 1 < argc) {
+            download_connections = std::atoi(argv[++i]);
+            if (download_connections < 1) {
+                UI::print_error("--connections must be at least 1");
+                return 1;
+            }
+        } else if ((arg == "--threads" || arg == "-th") && i + 1 < argc) {
+            config.n_threads = std::atoi(argv[++i]);
+        } else if ((arg == "--threads-batch" || arg == "-tb") && i + 1 < argc) {
+            config.n_threads_batch = std::atoi(argv[++i]);
+        } else if (arg == "--numa" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (!tools::SystemInfo::parse_numa_strategy(mode, config.numa)) {
+                UI::print_error("Unknown NUMA strategy: " + mode);
+                UI::print_info("Use one of: distribute, isolate, numactl, off");
+                return 1;
+            }
+        } else if ((arg == "--cache-type-k" || arg == "-ctk") && i + 1 < argc) {
+            std::string type = argv[++i];
+            if (!tools::ServerFlags::parse_kv_cache_type(type, config.kv_type_k)) {
+                UI::print_error("Unknown KV cache type: " + type);
+                UI::print_info("Use one of: f16, q8_0, q4_0");
+                return 1;
+            }
+        } else if ((arg == "--cache-type-v" || arg == "-ctv") && i + 1 < argc) {
+            std::string type = argv[++i];
+            if (!tools::ServerFlags::parse_kv_cache_type(type, config.kv_type_v)) {
+                UI::print_error("Unknown KV cache type: " + type);
+                UI::print_info("Use one of: f16, q8_0, q4_0");
+                return 1;
+            }
+        } else if ((arg == "--flash-attn" || arg == "-fa") && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (!tools::ServerFlags::parse_flash_attn(mode, config.flash_attn)) {
+                UI::print_error("Unknown flash attention mode: " + mode);
+                UI::print_info("Use one of: on, off, auto");
+                return 1;
+            }
+        } else if (arg == "--no-warmup") {
+            config.warmup = false;
+        } else if (arg == "--context-shift") {
+            config.context_shift = true;
+        } else if (arg == "--keep" && i + 1 < argc) {
+            config.n_keep = std::atoi(argv[++i]);
+        } else if (arg == "pull" && i == 1) {
             // Skip - already handled above
             continue;
+        } else if (is_pull_command && !arg.empty() && arg[0] != '-') {
+            pull_model_names.push_back(arg);
         } else if (!arg.empty() && arg[0] == '-') {
             // Unknown flag - might be a typo
             if (!show_help && !show_version && !show_models && !interactive && !start_server && !check_updates &&
@@ -568,9 +881,9 @@ int main(int argc, char** argv) {
 
     // Handle pull command
     if (is_pull_command) {
-        if (pull_model_name.empty()) {
+        if (pull_model_names.empty()) {
             UI::print_error("Please specify a model name");
-            UI::print_info("Usage: delta pull <model-name>");
+            UI::print_info("Usage: delta pull <model-name>...");
             UI::print_info("Example: delta pull qwen2.5:0.5b");
             UI::print_info("See available models: delta --list-models --available");
             return 1;
@@ -578,9 +891,13 @@ int main(int argc, char** argv) {
 
         UI::init();
         ModelManager model_mgr;
+        model_mgr.set_download_connections(download_connections);
+        if (pull_model_names.size() > 1) {
+            return run_pull(model_mgr, pull_model_names, max_downloads);
+        }
         model_mgr.set_progress_callback(download_progress_callback);
 
-        bool success = model_mgr.pull_model(pull_model_name);
+        bool success = model_mgr.pull_model(pull_model_names[0]);
         return success ? 0 : 1;
     }
 
@@ -893,14 +1210,26 @@ int main(int argc, char** argv) {
         if (server_ctx > 0) {
             cmd << " -c " << server_ctx;
         }
+        cmd << tools::SystemInfo::llama_server_thread_args(config.n_threads, config.n_threads_batch, config.numa);
+        if (!config.warmup) {
+            cmd << " --no-warmup";
+        }
 
-        if (server_ctx > 16384) {
-            cmd << " --flash-attn off";
-            if (server_ctx > 32768) {
-                cmd << " --gpu-layers 0";
-            }
-        } else {
-            cmd << " --flash-attn auto";
+        // Very long contexts default to flash attention off unless the user chose a mode;
+        // a quantized V cache needs it on (delta-server checks what llama-server supports)
+        FlashAttention flash_attn = config.flash_attn;
+        if (flash_attn == FlashAttention::Auto && server_ctx > 16384 && config.kv_type_v == KvCacheType::F16) {
+            flash_attn = FlashAttention::Off;
+        }
+        cmd << " --flash-attn " << tools::ServerFlags::flash_attn_name(flash_attn);
+        if (config.kv_type_k != KvCacheType::F16) {
+            cmd << " --cache-type-k " << tools::ServerFlags::kv_cache_type_name(config.kv_type_k);
+        }
+        if (config.kv_type_v != KvCacheType::F16) {
+            cmd << " --cache-type-v " << tools::ServerFlags::kv_cache_type_name(config.kv_type_v);
+        }
+        if (server_ctx > 32768) {
+            cmd << " --gpu-layers 0";
         }
         std::string model_name_lower = model_name;
         std::string model_alias_lower = model_alias;
@@ -920,6 +1249,9 @@ int main(int argc, char** argv) {
             cmd << " --reranking";
         if (!draft_model.empty())
             cmd << " --md \"" << draft_model << "\"";
+        std::string mmproj = config.mmproj_path.empty() ? ModelManager::get_mmproj_path(model_path) : config.mmproj_path;
+        if (!model_path.empty() && tools::FileOps::file_exists(mmproj))
+            cmd << " --mmproj \"" << mmproj << "\"";
         if (!grammar_file.empty())
             cmd << " --grammar-file \"" << grammar_file << "\"";
         if (!model_alias.empty()) {
@@ -957,6 +1289,12 @@ int main(int argc, char** argv) {
         return 0;
     }
 
+    if (is_rerank_command && model_name.empty()) {
+        UI::print_error("Please specify a reranker model");
+        UI::print_info("Usage: delta rerank -m <model-name> [--input <file>] [--top-n <N>]");
+        return 1;
+    }
+
     // Find and load model (only when user passed -m, a prompt, or --interactive)
     if (model_name.empty()) {
         // Try to get an auto-selected model
@@ -1015,6 +1353,47 @@ int main(int argc, char** argv) {
     }
 
     config.model_path = model_path;
+    if (config.mmproj_path.empty() && tools::FileOps::file_exists(ModelManager::get_mmproj_path(model_path))) {
+        config.mmproj_path = ModelManager::get_mmproj_path(model_path);
+    }
+
+    // Draft model for in-process speculative decoding: registry name or path to a .gguf
+    if (!draft_model.empty()) {
+        if (model_mgr.is_model_installed(draft_model)) {
+            config.draft_model_path = model_mgr.get_model_path(draft_model);
+        } else if (tools::FileOps::file_exists(draft_model)) {
+            config.draft_model_path = draft_model;
+        } else {
+            UI::print_warning("Draft model not found: " + draft_model + " (speculative decoding disabled)");
+        }
+    }
+
+    // Output constraints for in-process generation
+    if (!grammar_file.empty()) {
+        config.grammar = tools::FileOps::read_file(grammar_file);
+        if (config.grammar.empty()) {
+            UI::print_error("Cannot read grammar file: " + grammar_file);
+            return 1;
+        }
+    }
+    if (!json_schema.empty()) {
+        const size_t first = json_schema.find_first_not_of(" \t\r\n");
+        if (first != std::string::npos && json_schema[first] == '{') {
+            config.json_schema = json_schema;
+        } else {
+            config.json_schema = tools::FileOps::read_file(json_schema);
+            if (config.json_schema.empty()) {
+                UI::print_error("Cannot read JSON schema file: " + json_schema);
+                return 1;
+            }
+        }
+    }
+
+    // Batch mode decodes --parallel sequences at once; load_model sizes the
+    // context as -c (or the model's default) for each of them
+    if (is_batch_command) {
+        config.n_parallel = batch_parallel;
+    }
 
     InferenceEngine engine;
     if (!interactive && !prompt.empty()) {
@@ -1025,6 +1404,54 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    if (is_rerank_command) {
+        if (input_file.empty())
+            return run_rerank(engine, std::cin, top_n);
+        std::ifstream input(input_file);
+        if (!input) {
+            UI::print_error("Cannot open input file: " + input_file);
+            return 1;
+        }
+        return run_rerank(engine, input, top_n);
+    }
+
+    if (is_batch_command) {
+        std::ifstream input_stream;
+        std::ofstream output_stream;
+        if (!input_file.empty()) {
+            input_stream.open(input_file);
+            if (!input_stream) {
+                UI::print_error("Cannot open input file: " + input_file);
+                return 1;
+            }
+        }
+        if (!output_file.empty()) {
+            output_stream.open(output_file);
+            if (!output_stream) {
+                UI::print_error("Cannot open output file: " + output_file);
+                return 1;
+            }
+        }
+
+        // Ctrl+C stops the batch; finished results are already written
+        g_generating_engine.store(&engine);
+#ifndef _WIN32
+        struct sigaction sa;
+        sa.sa_handler = interrupt_signal_handler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = 0;
+        sigaction(SIGINT, &sa, nullptr);
+#else
+        SetConsoleCtrlHandler(console_ctrl_handler, TRUE);
+#endif
+        int status = run_batch(engine,
+                               input_file.empty() ? std::cin : static_cast<std::istream&>(input_stream),
+                               output_file.empty() ? std::cout : static_cast<std::ostream&>(output_stream),
+                               max_tokens);
+        g_generating_engine.store(nullptr);
+        return status;
+    }
+
     if (interactive || prompt.empty()) {
         if (prompt.empty())
             std::cout << std::endl;
@@ -1038,9 +1465,22 @@ int main(int argc, char** argv) {
     UI::print_info("Generating response...");
     std::cout << "\n";
     try {
-        std::string response = engine.generate(prompt, max_tokens, true);
+        std::string response = image_paths.empty()
+            ? engine.generate(prompt, max_tokens, true)
+            : engine.generate_multimodal(prompt, image_paths, max_tokens, true);
         std::cout << "\n" << std::endl;
 
+        const GenerationStats& stats = engine.get_last_stats();
+        if (stats.n_drafted > 0) {
+            UI::print_info("Speculative decoding: " + std::to_string(stats.n_draft_accepted) + "/" +
+                           std::to_string(stats.n_drafted) + " drafted tokens accepted (" +
+                           std::to_string(static_cast<int>(stats.draft_acceptance_rate() * 100.0 + 0.5)) + "%)");
+        }
+        if (stats.n_images > 0 && stats.n_image_cache_hits > 0) {
+            UI::print_info("Image embeddings reused from cache: " + std::to_string(stats.n_image_cache_hits) + "/" +
+                           std::to_string(stats.n_images));
+        }
+
         // Ensure response is displayed (fallback for non-streaming)
         if (response.empty()) {
             UI::print_warning("No response generated");
@@ -6,6 +6,7 @@
  * - GET /api/models/available - List all available models
  * - GET /api/models/list - List installed models
  * - POST /api/models/download - Download a model
+ * - GET /api/models/download/events - Download progress as Server-Sent Events
  * - DELETE /api/models/:name - Remove a model
  * - POST /api/models/use - Switch to a model
  */
@@ -24,6 +25,7 @@
 #include <functional>
 #include <map>
 #include <mutex>
+#include <condition_variable>
 #include <iomanip>
 #include <future>
 #include <chrono>
@@ -51,23 +53,100 @@ static std::string g_props_fallback_model_path;
 static std::string g_props_fallback_model_alias;
 static std::mutex g_props_fallback_mutex;
 
+static std::atomic<uint64_t> g_next_download_id{1};
+
 // Progress tracking structure
 struct DownloadProgress {
+    const uint64_t id = g_next_download_id++;    // tells apart repeated downloads of one model
     std::atomic<double> progress{0.0};
     std::atomic<long long> current_bytes{0};
     std::atomic<long long> total_bytes{0};
+    std::atomic<double> bytes_per_sec{0.0};     // smoothed throughput
+    std::atomic<uint64_t> version{0};           // bumped on every change; event streams send only changes
     std::atomic<bool> completed{false};
     std::atomic<bool> failed{false};
+    uint64_t finished_seq = 0;                  // g_download_finish_seq when it finished (under g_progress_mutex)
     std::string error_message;
     std::mutex mutex;
+    
+    // Last throughput sample (download thread only)
+    std::chrono::steady_clock::time_point rate_time = std::chrono::steady_clock::now();
+    long long rate_bytes = 0;
 };
 
 // Global progress map (model_name -> progress)
 static std::map<std::string, std::shared_ptr<DownloadProgress>> g_download_progress;
 static std::mutex g_progress_mutex;
-// Thread-local storage for current download progress
-thread_local std::shared_ptr<DownloadProgress> g_current_progress = nullptr;
-thread_local std::string g_current_model_name;
+// Signalled (with g_progress_mutex) when a download starts, completes or fails
+static std::condition_variable g_progress_changed;
+// Serializes the in-progress check and submit of POST /api/models/download
+static std::mutex g_download_submit_mutex;
+// Counts finished downloads (under g_progress_mutex); sent as the SSE event id, so a
+// reconnecting stream can be told which downloads finished while it was away
+static uint64_t g_download_finish_seq = 0;
+
+// Progress events per second per download on /api/models/download/events
+static const int kDownloadEventsPerSec = 4;
+
+// Record a libcurl progress tick (download thread only)
+static void record_download_progress(DownloadProgress& prog, double progress, long long current, long long total) {
+    prog.progress.store(progress);
+    prog.current_bytes.store(current);
+    prog.total_bytes.store(total);
+    
+    // Throughput over windows of at least half a second, smoothed so the ETA does not jump
+    const auto now = std::chrono::steady_clock::now();
+    if (current < prog.rate_bytes || prog.rate_bytes == 0) {
+        // First tick (a resumed download starts far from zero), or the next file of
+        // the same pull (e.g. the vision projector)
+        prog.rate_time = now;
+        prog.rate_bytes = current;
+    }
+    const double seconds = std::chrono::duration<double>(now - prog.rate_time).count();
+    if (seconds >= 0.5) {
+        const double rate = (current - prog.rate_bytes) / seconds;
+        const double smoothed = prog.bytes_per_sec.load();
+        prog.bytes_per_sec.store(smoothed > 0.0 ? 0.7 * smoothed + 0.3 * rate : rate);
+        prog.rate_time = now;
+        prog.rate_bytes = current;
+    }
+    prog.version.fetch_add(1);
+}
+
+// Mark a download finished and wake the event streams
+static void finish_download_progress(DownloadProgress& prog, bool success, const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(prog.mutex);
+        prog.error_message = error;
+    }
+    if (success) {
+        prog.progress.store(100.0);
+        prog.completed.store(true);
+    } else {
+        prog.failed.store(true);
+    }
+    prog.version.fetch_add(1);
+    std::lock_guard<std::mutex> lock(g_progress_mutex);
+    prog.finished_seq = ++g_download_finish_seq;
+    g_progress_changed.notify_all();
+}
+
+static json download_event_data(const std::string& model_name, DownloadProgress& prog) {
+    const long long current = prog.current_bytes.load();
+    const long long total = prog.total_bytes.load();
+    const double rate = prog.bytes_per_sec.load();
+    json data = {{"model", model_name},
+                 {"progress", prog.progress.load()},
+                 {"current_bytes", current},
+                 {"total_bytes", total},
+                 {"bytes_per_sec", rate},
+                 {"eta_seconds", rate > 0.0 && total > current ? json((total - current) / rate) : json(nullptr)}};
+    if (prog.failed.load()) {
+        std::lock_guard<std::mutex> lock(prog.mutex);
+        data["error_message"] = prog.error_message;
+    }
+    return data;
+}
 
 class ModelAPIServer {
   private:
@@ -77,6 +156,7 @@ class ModelAPIServer {
     std::thread server_thread_;
     std::atomic<bool> running_;
     ModelManager model_mgr_;
+    DownloadScheduler downloads_{model_mgr_};   // after model_mgr_: destroyed (and joined) first
 
     void write_props_fallback(httplib::Response& res) {
         std::string model_path;
@@ -266,6 +346,7 @@ class ModelAPIServer {
                                {"failed", prog->failed.load()}};
 
                 if (prog->failed.load()) {
+                    std::lock_guard<std::mutex> prog_lock(prog->mutex);
                     result["error_message"] = prog->error_message;
                 }
 
@@ -277,6 +358,75 @@ class ModelAPIServer {
             }
         });
 
+        // GET /api/models/download/events - One Server-Sent Events stream for all downloads:
+        // "progress" at most kDownloadEventsPerSec times a second per download, then
+        // "completed" or "failed". Replaces polling the progress endpoint per model.
+        // Events carry the finish counter as their id: a browser reconnecting after a
+        // dropped stream sends it back as Last-Event-ID and gets the final event of
+        // every download that finished in the meantime.
+        server_->Get("/api/models/download/events", [this](const httplib::Request& req, httplib::Response& res) {
+            static const uint64_t kFinished = UINT64_MAX;
+            uint64_t seen_seq = UINT64_MAX;     // new stream: only downloads still running
+            if (req.has_header("Last-Event-ID")) {
+                try {
+                    seen_seq = std::stoull(req.get_header_value("Last-Event-ID"));
+                } catch (...) {
+                }
+            }
+            // Last version pushed per download id; downloads the client already saw
+            // finish are not replayed
+            auto sent = std::make_shared<std::map<uint64_t, uint64_t>>();
+            {
+                std::lock_guard<std::mutex> lock(g_progress_mutex);
+                for (const auto& entry : g_download_progress) {
+                    const bool finished = entry.second->completed.load() || entry.second->failed.load();
+                    if (finished && entry.second->finished_seq <= seen_seq) {
+                        (*sent)[entry.second->id] = kFinished;
+                    }
+                }
+            }
+            auto last_write = std::make_shared<std::chrono::steady_clock::time_point>(std::chrono::steady_clock::now());
+
+            res.set_header("Cache-Control", "no-cache");
+            res.set_header("X-Accel-Buffering", "no");
+            res.set_chunked_content_provider("text/event-stream", [this, sent, last_write](size_t, httplib::DataSink& sink) {
+                std::string events;
+                {
+                    std::unique_lock<std::mutex> lock(g_progress_mutex);
+                    g_progress_changed.wait_for(lock, std::chrono::milliseconds(1000 / kDownloadEventsPerSec));
+                    const std::string id = "id: " + std::to_string(g_download_finish_seq) + "\n";
+                    for (const auto& entry : g_download_progress) {
+                        DownloadProgress& prog = *entry.second;
+                        const uint64_t version = prog.version.load();
+                        auto it = sent->find(prog.id);
+                        if (it != sent->end() && (it->second == kFinished || it->second == version)) {
+                            continue;
+                        }
+                        const bool finished = prog.completed.load() || prog.failed.load();
+                        const char* type = prog.completed.load() ? "completed" : (prog.failed.load() ? "failed" : "progress");
+                        events += id + "event: " + std::string(type) + "\ndata: " +
+                                  download_event_data(entry.first, prog).dump() + "\n\n";
+                        (*sent)[prog.id] = finished ? kFinished : version;
+                    }
+                }
+                if (!running_) {
+                    sink.done();
+                    return false;
+                }
+
+                // A comment line now and then lets us notice clients that went away
+                const auto now = std::chrono::steady_clock::now();
+                if (events.empty()) {
+                    if (now - *last_write < std::chrono::seconds(15)) {
+                        return true;
+                    }
+                    events = ": keep-alive\n\n";
+                }
+                *last_write = now;
+                return sink.write(events.data(), events.size());
+            });
+        });
+
         // POST /api/models/download - Download a model (async)
         server_->Post("/api/models/download", [this](const httplib::Request& req, httplib::Response& res) {
             try {
@@ -290,17 +440,16 @@ class ModelAPIServer {
                     return;
                 }
 
-                // Check if download is already in progress
-                {
-                    std::lock_guard<std::mutex> lock(g_progress_mutex);
-                    auto it = g_download_progress.find(model_name);
-                    if (it != g_download_progress.end() && !it->second->completed.load() &&
-                        !it->second->failed.load()) {
-                        json error = {{"error", {{"code", 409}, {"message", "Download already in progress"}}}};
-                        res.status = 409;
-                        res.set_content(error.dump(), "application/json");
-                        return;
-                    }
+                // Check if download is already in progress. Ask the scheduler, which knows
+                // that aliases such as "qwen3:0.6b" and "qwen3-0.6b" are the same file; the
+                // check and the submit below happen under one lock so two requests cannot
+                // both get through.
+                std::lock_guard<std::mutex> submit_lock(g_download_submit_mutex);
+                if (downloads_.find(model_name)) {
+                    json error = {{"error", {{"code", 409}, {"message", "Download already in progress"}}}};
+                    res.status = 409;
+                    res.set_content(error.dump(), "application/json");
+                    return;
                 }
 
                 // Create progress tracker
@@ -308,92 +457,39 @@ class ModelAPIServer {
                 {
                     std::lock_guard<std::mutex> lock(g_progress_mutex);
                     g_download_progress[model_name] = progress;
+                    g_progress_changed.notify_all();
                 }
 
-                // Start download in background thread
-                std::thread download_thread([this, model_name, progress]() {
-                    try {
 #ifdef _WIN32
-                        // Ensure UTF-8 so progress bar (█ ▓ ▙) and ✓/✗ display correctly in console
-                        SetConsoleOutputCP(65001);
-                        SetConsoleCP(65001);
+                // Ensure UTF-8 so progress bar (█ ▓ ▙) and ✓/✗ display correctly in console
+                SetConsoleOutputCP(65001);
+                SetConsoleCP(65001);
 #endif
-                        // Set thread-local variables for callback
-                        g_current_progress = progress;
-                        g_current_model_name = model_name;
-
-                        // Static progress callback function (ASCII bar on Windows so it never garbles)
-                        static auto progress_cb = [](double prog, long long current, long long total) {
-                            if (g_current_progress) {
-                                g_current_progress->progress.store(prog);
-                                g_current_progress->current_bytes.store(current);
-                                g_current_progress->total_bytes.store(total);
-
-                                double current_mb = current / (1024.0 * 1024.0);
-                                double total_mb = total / (1024.0 * 1024.0);
-                                int bar_width = 50;
-                                int pos = (int)(prog / 100.0 * bar_width);
-
-                                std::cout << "\r[Download " << g_current_model_name << "] [";
-#ifdef _WIN32
-                                for (int i = 0; i < bar_width; i++) {
-                                    if (i < pos)
-                                        std::cout << "#";
-                                    else if (i == pos)
-                                        std::cout << ">";
-                                    else
-                                        std::cout << "-";
-                                }
-#else
-                                for (int i = 0; i < bar_width; i++) {
-                                    if (i < pos) std::cout << "█";
-                                    else if (i == pos) std::cout << "▓";
-                                    else std::cout << "░";
-                                }
-#endif
-                                std::cout << "] " << std::fixed << std::setprecision(1) << prog << "% ";
-                                std::cout << "(" << std::fixed << std::setprecision(1) << current_mb << " / ";
-                                std::cout << total_mb << " MB)";
-                                std::cout << std::flush;
-                            }
-                        };
-
-                        // Set up progress callback for terminal output
-                        model_mgr_.set_progress_callback(progress_cb);
-
-                        // Download model
-                        bool success = model_mgr_.pull_model(model_name);
-
-                        // Clear progress callback and thread-local
-                        model_mgr_.set_progress_callback(nullptr);
-                        g_current_progress = nullptr;
-
-                        if (success) {
-                            progress->completed.store(true);
-                            progress->progress.store(100.0);
-                            std::cout << std::endl;
+                // Queue the download; up to DownloadScheduler::kDefaultMaxConcurrent run at once
+                const std::string label = "[Download " + model_name + "]";
+                auto on_progress = [progress, label](double prog, long long current, long long total) {
+                    record_download_progress(*progress, prog, current, total);
+                    UI::print_download_progress(prog, current, total, label);
+                };
+                auto on_finish = [progress, label](DownloadJob& job) {
+                    const bool success = job.state() == DownloadJob::State::Completed;
+                    const bool cancelled = job.state() == DownloadJob::State::Cancelled;
+                    const std::string error = job.error();
+                    finish_download_progress(*progress, success,
+                                             success ? "" : cancelled ? "Download cancelled" :
+                                             error.empty() ? "Download failed" : "Download failed: " + error);
+                    std::cout << std::endl;
+                    if (success) {
 #ifdef _WIN32
-                            std::cout << "[Download " << model_name << "] [OK] Download completed successfully!"
-                                      << std::endl;
+                        std::cout << label << " [OK] Download completed successfully!" << std::endl;
 #else
-                            std::cout << "[Download " << model_name << "] ✓ Download completed successfully!" << std::endl;
+                        std::cout << label << " ✓ Download completed successfully!" << std::endl;
 #endif
-                        } else {
-                            progress->failed.store(true);
-                            progress->error_message = "Download failed";
-                            std::cout << std::endl;
-                            std::cout << "[Download " << model_name << "] Download failed" << std::endl;
-                        }
-                    } catch (const std::exception& e) {
-                        progress->failed.store(true);
-                        progress->error_message = e.what();
-                        model_mgr_.set_progress_callback(nullptr);
-                        g_current_progress = nullptr;
-                        std::cout << std::endl;
-                        std::cout << "[Download " << model_name << "] Error: " << e.what() << std::endl;
+                    } else {
+                        std::cout << label << (cancelled ? " Download cancelled" : " Download failed") << std::endl;
                     }
-                });
-                download_thread.detach();
+                };
+                downloads_.submit(model_name, on_progress, on_finish);
 
                 // Return immediately
                 json result = {{"success", true}, {"message", "Download started"}, {"model", model_name}};
@@ -414,12 +510,21 @@ class ModelAPIServer {
             try {
                 json body = json::parse(req.body);
                 std::string model_name = body.value("model", "");
-                (void)model_name; // Currently unused – global cancel affects any active download
 
-                // Signal cancellation to ModelManager via shared flag
-                model_mgr_.cancel_download();
+                // Without a model name, cancel every download (the old behaviour)
+                if (model_name.empty()) {
+                    downloads_.cancel_all();
+                } else if (!downloads_.cancel(model_name)) {
+                    json error = {{"error", {{"code", 404}, {"message", "No download in progress for " + model_name}}}};
+                    res.status = 404;
+                    res.set_content(error.dump(), "application/json");
+                    return;
+                }
 
                 json result = {{"success", true}, {"message", "Download cancellation requested"}};
+                if (!model_name.empty()) {
+                    result["model"] = model_name;
+                }
                 res.set_content(result.dump(), "application/json");
             } catch (const json::parse_error&) {
                 json error = {{"error", {{"code", 400}, {"message", "Invalid JSON in request body"}}}};
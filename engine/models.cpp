@@ -12,11 +12,21 @@
 #include <iostream>
 #include <cctype>
 #include <atomic>
+#include <mutex>
+#include <thread>
+#include <cerrno>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
 
 namespace delta {
 
-// Global cancellation flag for downloads (shared between CLI and API server)
-static std::atomic<bool> g_download_cancel_requested{false};
+// Downloads currently running in this process (shared between CLI and API server),
+// so cancel_download() can reach them without knowing who started them
+static std::mutex g_active_downloads_mutex;
+static std::vector<DownloadJob*> g_active_downloads;
 
 // Define the default model (qwen3:0.6b - 400 MB, ultra-compact multilingual)
 const std::string ModelManager::DEFAULT_MODEL_NAME = "qwen3:0.6b";
@@ -141,9 +151,21 @@ bool ModelManager::remove_model(const std::string& model_name) {
         return false;
     }
     
+    std::string mmproj_path = get_mmproj_path(path);
+    if (tools::FileOps::file_exists(mmproj_path)) {
+        std::remove(mmproj_path.c_str());
+    }
     return std::remove(path.c_str()) == 0;
 }
 
+std::string ModelManager::get_mmproj_path(const std::string& model_path) {
+    std::string base = model_path;
+    if (base.length() > 5 && base.substr(base.length() - 5) == ".gguf") {
+        base = base.substr(0, base.length() - 5);
+    }
+    return base + ".mmproj";
+}
+
 bool ModelManager::remove_model_with_confirmation(const std::string& model_name) {
     // Resolve model name (handle short names like "qwen3:0.6b")
     std::string resolved_name = resolve_model_name(model_name);
@@ -250,8 +272,27 @@ std::map<std::string, std::string> ModelManager::get_model_info(const std::strin
 }
 
 void ModelManager::cancel_download() {
-    // Signal any in-progress libcurl transfer to abort on next progress callback
-    g_download_cancel_requested.store(true);
+    // Signal every in-progress libcurl transfer to abort on its next progress callback
+    std::lock_guard<std::mutex> lock(g_active_downloads_mutex);
+    for (DownloadJob* job : g_active_downloads) {
+        job->cancel();
+    }
+}
+
+void ModelManager::set_download_connections(int connections) {
+    download_connections_ = std::max(1, connections);
+}
+
+bool ModelManager::cancel_download(const std::string& model_name) {
+    std::lock_guard<std::mutex> lock(g_active_downloads_mutex);
+    bool found = false;
+    for (DownloadJob* job : g_active_downloads) {
+        if (job->model_name() == model_name) {
+            job->cancel();
+            found = true;
+        }
+    }
+    return found;
 }
 
 // ============================================================================
@@ -1912,6 +1953,22 @@ void ModelManager::init_model_registry() {
         "Bonsai 1.7B",
         0  // use model default (-c from model)
     };
+
+    // ===== VISION PROJECTORS (mmproj files shipped next to the model) =====
+    const std::pair<const char*, const char*> projectors[] = {
+        {"tinygemma3", "mmproj-tinygemma3.gguf"},
+        {"gemma3:4b", "mmproj-model-f16.gguf"},
+        {"gemma3:12b", "mmproj-model-f16.gguf"},
+        {"qwen2.5vl:3b", "mmproj-Qwen2.5-VL-3B-Instruct-Q8_0.gguf"},
+        {"qwen2vl:2b", "mmproj-Qwen2-VL-2B-Instruct-Q8_0.gguf"},
+        {"llava", "llava-v1.5-7b-mmproj-model-f16.gguf"},
+    };
+    for (const auto& projector : projectors) {
+        auto it = model_registry_.find(projector.first);
+        if (it != model_registry_.end()) {
+            it->second.mmproj_filename = projector.second;
+        }
+    }
 }
 
 std::vector<ModelRegistry> ModelManager::get_registry_models() {
@@ -2201,11 +2258,290 @@ std::string ModelManager::get_hf_url(const std::string& repo_id, const std::stri
     return "https://huggingface.co/" + repo_id + "/resolve/main/" + filename;
 }
 
+bool DownloadResume::read(const std::string& path, ResumeInfo& info) {
+    std::ifstream f(path);
+    if (!f) return false;
+    std::string line;
+    while (std::getline(f, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) continue;
+        std::string key = line.substr(0, tab);
+        std::string value = line.substr(tab + 1);
+        if (key == "url") info.url = value;
+        else if (key == "etag") info.etag = value;
+        else if (key == "last_modified") info.last_modified = value;
+        else if (key == "size") {
+            try { info.size = std::stoll(value); } catch (...) { return false; }
+        } else if (key == "segment") {
+            ResumeInfo::Segment segment;
+            std::istringstream fields(value);
+            if (!(fields >> segment.start >> segment.end >> segment.done)) return false;
+            info.segments.push_back(segment);
+        } else if (key == "sha256_state") {
+            info.hash_state = value;
+        }
+    }
+    return !info.url.empty();
+}
+
+void DownloadResume::write(const std::string& path, const ResumeInfo& info) {
+    std::ofstream f(path);
+    if (!f) return;
+    f << "url\t" << info.url << '\n'
+      << "etag\t" << info.etag << '\n'
+      << "last_modified\t" << info.last_modified << '\n'
+      << "size\t" << info.size << '\n';
+    for (const auto& segment : info.segments) {
+        f << "segment\t" << segment.start << ' ' << segment.end << ' ' << segment.done << '\n';
+    }
+    if (!info.hash_state.empty()) {
+        f << "sha256_state\t" << info.hash_state << '\n';
+    }
+}
+
+static long long file_size(const std::string& path) {
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    return f ? static_cast<long long>(f.tellg()) : 0;
+}
+
+// A partial file can only be continued if the server still has the same bytes:
+// a strong ETag (weak ones are not valid for range requests) or else Last-Modified
+bool DownloadResume::has_validator(const ResumeInfo& info) {
+    bool strong_etag = !info.etag.empty() && info.etag.compare(0, 2, "W/") != 0;
+    return info.size > 0 && (strong_etag || !info.last_modified.empty());
+}
+
+bool DownloadResume::same_remote_file(const ResumeInfo& saved, const ResumeInfo& remote) {
+    if (!has_validator(remote) || saved.url != remote.url || saved.size != remote.size) {
+        return false;
+    }
+    if (!remote.etag.empty() && remote.etag.compare(0, 2, "W/") != 0) {
+        return saved.etag == remote.etag;
+    }
+    return saved.last_modified == remote.last_modified;
+}
+
+// Header lines of every hop come through here, so a status line clears what earlier
+// (redirect) hops set and the last response's validators win
+void DownloadResume::parse_header(const std::string& header, ResumeInfo& info) {
+    std::string line = header;
+    while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) {
+        line.pop_back();
+    }
+    
+    if (line.compare(0, 5, "HTTP/") == 0) {
+        info.etag.clear();
+        info.last_modified.clear();
+        info.size = -1;
+        info.accept_ranges = false;
+        return;
+    }
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+        return;
+    }
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+    size_t start = line.find_first_not_of(" \t", colon + 1);
+    std::string value = start == std::string::npos ? "" : line.substr(start);
+    
+    if (name == "etag") {
+        info.etag = value;
+    } else if (name == "last-modified") {
+        info.last_modified = value;
+    } else if (name == "content-length") {
+        try { info.size = std::stoll(value); } catch (...) { info.size = -1; }
+    } else if (name == "accept-ranges") {
+        info.accept_ranges = value.find("bytes") != std::string::npos;
+    } else if (name == "x-linked-etag" && info.linked_sha256.empty()) {
+        // Sent on the first (redirect) hop for LFS files: the quoted SHA-256 of the content
+        std::string digest = value;
+        digest.erase(std::remove(digest.begin(), digest.end(), '"'), digest.end());
+        std::transform(digest.begin(), digest.end(), digest.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (digest.size() == 64 && digest.find_first_not_of("0123456789abcdef") == std::string::npos) {
+            info.linked_sha256 = digest;
+        }
+    }
+}
+
+bool DownloadResume::range_ignored(long long offset, long response_code) {
+    return offset > 0 && response_code == 200;
+}
+
+std::vector<ResumeInfo::Segment> DownloadResume::plan_segments(long long begin, long long size, int connections) {
+    std::vector<ResumeInfo::Segment> segments;
+    const long long remaining = size - begin;
+    const long long count = std::max(1LL, std::min<long long>(connections, remaining / kMinSegmentBytes));
+    const long long step = remaining / count;
+    for (long long i = 0; i < count; i++) {
+        ResumeInfo::Segment segment;
+        segment.start = begin + i * step;
+        segment.end = (i == count - 1) ? size : segment.start + step;
+        segments.push_back(segment);
+    }
+    return segments;
+}
+
+std::vector<ResumeInfo::Segment> DownloadResume::resume_segments(const ResumeInfo* saved, long long single_stream_offset,
+                                                                 long long size, int connections) {
+    if (saved && !saved->segments.empty()) {
+        return saved->segments;
+    }
+    
+    // A single-stream partial becomes the first, already complete, segment
+    std::vector<ResumeInfo::Segment> segments;
+    if (single_stream_offset > 0) {
+        segments.push_back(ResumeInfo::Segment{0, single_stream_offset, single_stream_offset});
+    }
+    std::vector<ResumeInfo::Segment> rest = plan_segments(single_stream_offset, size, connections);
+    segments.insert(segments.end(), rest.begin(), rest.end());
+    return segments;
+}
+
+long long DownloadResume::hashable_end(const std::vector<ResumeInfo::Segment>& segments, long long pos) {
+    for (const auto& segment : segments) {
+        if (pos < segment.start || pos >= segment.end) continue;
+        return segment.start + segment.done;
+    }
+    return pos;
+}
+
+// libcurl header callback
+static size_t header_callback(char* buffer, size_t size, size_t nitems, void* userdata) {
+    size_t total_size = size * nitems;
+    DownloadResume::parse_header(std::string(buffer, total_size), *static_cast<ResumeInfo*>(userdata));
+    return total_size;
+}
+
+// HEAD the URL for the size and validators that decide whether a partial file can be resumed
+static CURLcode probe_remote_file(const std::string& url, ResumeInfo& remote, long& response_code) {
+    response_code = 0;
+    CURL* curl = curl_easy_init();
+    if (!curl) {
+        return CURLE_FAILED_INIT;
+    }
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Delta-CLI/1.0");
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &remote);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    curl_easy_cleanup(curl);
+    return res;
+}
+
+// SHA-256 of the download, advanced in file order. Bytes are hashed in the write path as
+// they arrive at the hash position; bytes that reach the disk ahead of it (other segments,
+// a partial file from an earlier run) are read back later, usually from the page cache.
+struct StreamHash {
+    bool enabled = false;
+    tools::Sha256 sha;
+    long long pos = 0;          // bytes [0, pos) are hashed
+    std::ifstream reader;
+    
+    void feed(long long offset, const void* data, size_t size) {
+        if (enabled && offset == pos) {
+            sha.update(data, size);
+            pos += static_cast<long long>(size);
+        }
+    }
+    
+    void reset() {
+        sha = tools::Sha256();
+        pos = 0;
+    }
+    
+    // Hash what is on disk in [pos, until), reading at most `budget` bytes
+    bool catch_up(const std::string& path, long long until, long long budget = -1) {
+        if (!enabled || pos >= until) {
+            return true;
+        }
+        if (!reader.is_open()) {
+            reader.open(path, std::ios::binary);
+        }
+        reader.clear();
+        reader.seekg(static_cast<std::streamoff>(pos));
+        std::vector<char> chunk(1024 * 1024);
+        while (pos < until && budget != 0) {
+            long long want = std::min<long long>(static_cast<long long>(chunk.size()), until - pos);
+            if (budget > 0) {
+                want = std::min(want, budget);
+                budget -= want;
+            }
+            reader.read(chunk.data(), static_cast<std::streamsize>(want));
+            if (reader.gcount() != want) {
+                return false;
+            }
+            sha.update(chunk.data(), static_cast<size_t>(want));
+            pos += want;
+        }
+        return true;
+    }
+};
+
+// State shared by the write and progress callbacks of one transfer
+struct Transfer {
+    CURL* curl = nullptr;
+    DownloadJob* job = nullptr;
+    std::string temp_path;
+    std::ofstream file;
+    curl_off_t offset = 0;      // bytes already on disk when the request was made
+    long long file_pos = 0;     // bytes on disk now
+    bool checked_status = false;
+    
+    // Hash midstate is saved to the sidecar about once a second (null: not resumable)
+    StreamHash* hash = nullptr;
+    ResumeInfo* info = nullptr;
+    std::string meta_path;
+    std::chrono::steady_clock::time_point last_save;
+};
+
 // libcurl write callback
 static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
     size_t total_size = size * nmemb;
-    std::ofstream* file = static_cast<std::ofstream*>(userp);
-    file->write(static_cast<const char*>(contents), total_size);
+    Transfer* transfer = static_cast<Transfer*>(userp);
+    
+    // A server that ignores the Range header answers 200 with the whole file: start over
+    if (!transfer->checked_status) {
+        transfer->checked_status = true;
+        long response_code = 0;
+        curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &response_code);
+        if (DownloadResume::range_ignored(transfer->offset, response_code)) {
+            transfer->file.close();
+            transfer->file.open(transfer->temp_path, std::ios::binary | std::ios::trunc);
+            transfer->offset = 0;
+            transfer->file_pos = 0;
+            if (transfer->hash) {
+                transfer->hash->reset();
+            }
+        }
+    }
+    
+    transfer->file.write(static_cast<const char*>(contents), total_size);
+    if (!transfer->file) {
+        return 0;   // aborts with CURLE_WRITE_ERROR (e.g. disk full)
+    }
+    if (transfer->hash) {
+        transfer->hash->feed(transfer->file_pos, contents, total_size);
+    }
+    transfer->file_pos += static_cast<long long>(total_size);
+    
+    if (transfer->hash && transfer->hash->enabled && transfer->info) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - transfer->last_save >= std::chrono::seconds(1)) {
+            // Flush first: the saved midstate must never cover bytes that are not on disk
+            transfer->file.flush();
+            transfer->info->hash_state = transfer->hash->sha.save_state();
+            DownloadResume::write(transfer->meta_path, *transfer->info);
+            transfer->last_save = now;
+        }
+    }
     return total_size;
 }
 
@@ -2216,109 +2552,582 @@ static int progress_callback_wrapper(void* clientp,
     (void)ultotal;
     (void)ulnow;
     
+    Transfer* transfer = static_cast<Transfer*>(clientp);
+    DownloadJob* job = transfer->job;
+    
     // If cancellation was requested, abort the transfer
-    if (g_download_cancel_requested.load()) {
+    if (job->cancel_requested()) {
         return 1; // Non-zero return value tells libcurl to abort
     }
     
+    // libcurl counts only this request; report against the whole file
     if (dltotal > 0) {
-        ModelManager::ProgressCallback* callback = 
-            static_cast<ModelManager::ProgressCallback*>(clientp);
-        if (*callback) {
-            double progress = (double)dlnow / (double)dltotal * 100.0;
-            (*callback)(progress, dlnow, dltotal);
-        }
+        curl_off_t current = transfer->offset + dlnow;
+        curl_off_t total = transfer->offset + dltotal;
+        double progress = (double)current / (double)total * 100.0;
+        job->report_progress(progress, current, total);
     }
     return 0; // Return 0 to continue download
 }
 
-bool ModelManager::download_file(const std::string& url, 
-                                 const std::string& dest_path,
-                                 ProgressCallback progress) {
-    CURL* curl;
-    CURLcode res;
-    bool success = false;
+// curl_global_init is not thread-safe, and concurrent downloads must not
+// tear it down under each other, so initialize once for the process
+static void ensure_curl_initialized() {
+    static std::once_flag once;
+    std::call_once(once, []() { curl_global_init(CURL_GLOBAL_DEFAULT); });
+}
+
+// Errors worth another attempt from where the partial file ends
+static bool is_transient_error(CURLcode res, long response_code) {
+    switch (res) {
+        case CURLE_PARTIAL_FILE:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+            return true;
+        case CURLE_HTTP_RETURNED_ERROR:
+            return response_code >= 500;
+        default:
+            return false;
+    }
+}
+
+static CURLcode perform_transfer(const std::string& url, Transfer& transfer, long& response_code) {
+    CURL* curl = curl_easy_init();
+    if (!curl) {
+        return CURLE_FAILED_INIT;
+    }
+    transfer.curl = curl;
+    transfer.checked_status = false;
     
-    // Clear any previous cancellation request for a new download
-    g_download_cancel_requested.store(false);
+    // Set URL
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     
-    // Create temporary file path
-    std::string temp_path = dest_path + ".tmp";
+    // Follow redirects
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);
+    
+    // Continue after the bytes already on disk
+    if (transfer.offset > 0) {
+        curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, transfer.offset);
+    }
+    
+    // HTTP errors fail the transfer instead of writing the error page into the partial file
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    
+    // Set write callback
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+    
+    // Set user agent
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Delta-CLI/1.0");
+    
+    // Progress meter; always on, since it is also where cancellation is checked
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_callback_wrapper);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &transfer);
+    
+    // No signals: timeouts would otherwise use SIGALRM, which is unsafe with several transfer threads
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    
+    // Set timeout (30 seconds connect, 0 = infinite transfer); a connection stalled
+    // below 1 KB/s for a minute times out so it can be retried
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 0L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1024L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60L);
+    
+    // Perform download
+    CURLcode res = curl_easy_perform(curl);
+    response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    
+    // Cleanup
+    curl_easy_cleanup(curl);
+    transfer.curl = nullptr;
+    transfer.file.flush();
+    return res;
+}
+
+// One connection, resuming after `offset` bytes; transient errors are retried from what reached the disk
+static bool download_single_stream(const std::string& url, const std::string& temp_path,
+                                   const std::string& meta_path, ResumeInfo* info, curl_off_t offset,
+                                   StreamHash& hash, DownloadJob& job, CURLcode& res, long& response_code) {
+    const bool resumable = info != nullptr;
+    Transfer transfer;
+    transfer.job = &job;
+    transfer.temp_path = temp_path;
+    transfer.offset = offset;
+    transfer.file_pos = offset;
+    transfer.hash = &hash;
+    transfer.info = info;
+    transfer.meta_path = meta_path;
+    transfer.last_save = std::chrono::steady_clock::now();
+    
+    // Bytes from an earlier run that the saved midstate does not cover
+    if (!hash.catch_up(temp_path, offset)) {
+        res = CURLE_READ_ERROR;
+        return false;
+    }
     
     // Open file for writing
-    std::ofstream file(temp_path, std::ios::binary);
-    if (!file.is_open()) {
+    transfer.file.open(temp_path, transfer.offset > 0 ? std::ios::binary | std::ios::app
+                                                      : std::ios::binary | std::ios::trunc);
+    if (!transfer.file.is_open()) {
+        res = CURLE_WRITE_ERROR;
         return false;
     }
     
-    // Initialize curl
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-    curl = curl_easy_init();
+    const int max_attempts = 5;
+    for (int attempt = 1; ; attempt++) {
+        res = perform_transfer(url, transfer, response_code);
+        if (res == CURLE_OK) {
+            return true;
+        }
+        if (job.cancel_requested() || attempt == max_attempts || !is_transient_error(res, response_code)) {
+            // Leave the midstate for everything written, so the next pull need not re-read it
+            transfer.file.close();
+            if (info && hash.enabled && hash.pos == file_size(temp_path)) {
+                info->hash_state = hash.sha.save_state();
+                DownloadResume::write(meta_path, *info);
+            }
+            return false;
+        }
+        
+        // Back off, then continue from what reached the disk (or restart if the file cannot be resumed)
+        int delay_seconds = 1 << attempt;
+        UI::print_warning("Connection lost (" + std::string(curl_easy_strerror(res)) + "), retrying in " +
+                          std::to_string(delay_seconds) + "s...");
+        for (int i = 0; i < delay_seconds * 10 && !job.cancel_requested(); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        transfer.file.close();
+        transfer.offset = resumable ? file_size(temp_path) : 0;
+        transfer.file_pos = transfer.offset;
+        if (transfer.offset == 0) {
+            hash.reset();
+        }
+        transfer.file.open(temp_path, transfer.offset > 0 ? std::ios::binary | std::ios::app
+                                                          : std::ios::binary | std::ios::trunc);
+        if (!transfer.file.is_open()) {
+            res = CURLE_WRITE_ERROR;
+            return false;
+        }
+    }
+}
+
+#ifndef _WIN32
+// CDNs throttle each connection, so large files are fetched as several byte ranges
+// at once, each written at its own offset into a preallocated file
+static const long long kSegmentedMinBytes = 64LL * 1024 * 1024;
+
+enum class SegmentedResult { Done, Failed, Cancelled, Unsupported };
+
+struct SegmentTransfer {
+    ResumeInfo::Segment* segment = nullptr;
+    int fd = -1;
+    CURL* curl = nullptr;           // null while the segment is not in flight
+    StreamHash* hash = nullptr;
+    int attempts = 0;
+    std::chrono::steady_clock::time_point retry_at;
+    bool checked_status = false;
+    bool range_ignored = false;     // server answered 200 instead of 206
+    bool write_failed = false;
+};
+
+static size_t segment_write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t total_size = size * nmemb;
+    SegmentTransfer* transfer = static_cast<SegmentTransfer*>(userp);
+    
+    if (!transfer->checked_status) {
+        transfer->checked_status = true;
+        long response_code = 0;
+        curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &response_code);
+        if (response_code != 206) {
+            transfer->range_ignored = true;
+            return 0;
+        }
+    }
+    
+    // Never write past the segment, even if the server sends more than was asked for
+    ResumeInfo::Segment& segment = *transfer->segment;
+    size_t wanted = static_cast<size_t>(std::min<long long>(static_cast<long long>(total_size),
+                                                            segment.end - segment.start - segment.done));
+    const char* data = static_cast<const char*>(contents);
+    size_t written = 0;
+    while (written < wanted) {
+        ssize_t n = pwrite(transfer->fd, data + written, wanted - written,
+                           static_cast<off_t>(segment.start + segment.done + static_cast<long long>(written)));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            transfer->write_failed = true;
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+    
+    // Hash only what reached the disk, so a saved midstate never covers missing bytes
+    transfer->hash->feed(segment.start + segment.done, data, written);
+    segment.done += static_cast<long long>(written);
+    return transfer->write_failed ? 0 : total_size;
+}
+
+// Reserve the whole file up front, so a full disk fails now rather than at 95%
+static bool preallocate_file(int fd, long long size) {
+#ifdef __linux__
+    int err = posix_fallocate(fd, 0, static_cast<off_t>(size));
+    if (err == 0) return true;
+    if (err == ENOSPC) return false;
+    // Filesystems without fallocate: a sparse file of the right size works as well
+#endif
+    return ftruncate(fd, static_cast<off_t>(size)) == 0;
+}
+
+static bool start_segment(CURLM* multi, const std::string& url, SegmentTransfer& transfer) {
+    CURL* curl = curl_easy_init();
+    if (!curl) {
+        return false;
+    }
+    const ResumeInfo::Segment& segment = *transfer.segment;
+    std::string range = std::to_string(segment.start + segment.done) + "-" + std::to_string(segment.end - 1);
+    
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, segment_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, &transfer);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Delta-CLI/1.0");
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1024L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60L);
+    
+    transfer.curl = curl;
+    transfer.checked_status = false;
+    curl_multi_add_handle(multi, curl);
+    return true;
+}
+
+// Download `remote` over up to `connections` ranges with curl_multi. Segment progress is
+// saved in the sidecar so an interrupted download continues each range where it stopped.
+static SegmentedResult download_segmented(const std::string& url, const std::string& temp_path,
+                                          const std::string& meta_path, const ResumeInfo& remote,
+                                          const ResumeInfo* saved, long long single_stream_offset,
+                                          int connections, StreamHash& hash, DownloadJob& job,
+                                          CURLcode& res, long& response_code) {
+    ResumeInfo info = remote;
+    info.segments = DownloadResume::resume_segments(saved, single_stream_offset, info.size, connections);
+    
+    long long done = 0;
+    for (const auto& segment : info.segments) {
+        done += segment.done;
+    }
+    if (done > 0) {
+        UI::print_info("Resuming download at " + UI::format_size(done) + " of " + UI::format_size(info.size));
+    }
+    
+    int fd = open(temp_path.c_str(), done > 0 ? O_RDWR | O_CREAT : O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !preallocate_file(fd, info.size)) {
+        if (fd >= 0) close(fd);
+        res = CURLE_WRITE_ERROR;
+        return SegmentedResult::Failed;
+    }
+    info.hash_state = hash.enabled ? hash.sha.save_state() : "";
+    DownloadResume::write(meta_path, info);
+    
+    CURLM* multi = curl_multi_init();
+    std::vector<SegmentTransfer> transfers(info.segments.size());
+    for (size_t i = 0; i < transfers.size(); i++) {
+        transfers[i].segment = &info.segments[i];
+        transfers[i].fd = fd;
+        transfers[i].hash = &hash;
+    }
     
-    if (curl) {
-        // Set URL
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    const int max_attempts = 5;
+    SegmentedResult result = SegmentedResult::Done;
+    bool stop = false;
+    auto last_save = std::chrono::steady_clock::now();
+    while (!stop) {
+        if (job.cancel_requested()) {
+            res = CURLE_ABORTED_BY_CALLBACK;
+            result = SegmentedResult::Cancelled;
+            break;
+        }
         
-        // Follow redirects
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);
+        // (Re)start every unfinished segment that is not in flight or backing off
+        const auto now = std::chrono::steady_clock::now();
+        size_t in_flight = 0;
+        size_t waiting = 0;
+        for (auto& transfer : transfers) {
+            if (transfer.segment->complete()) continue;
+            if (!transfer.curl && now >= transfer.retry_at && !start_segment(multi, url, transfer)) {
+                transfer.retry_at = now + std::chrono::seconds(1);
+            }
+            if (transfer.curl) in_flight++; else waiting++;
+        }
+        if (in_flight == 0 && waiting == 0) {
+            break;      // every segment is on disk
+        }
         
-        // Set write callback
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &file);
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
         
-        // Set user agent
-        curl_easy_setopt(curl, CURLOPT_USERAGENT, "Delta-CLI/1.0");
+        int queued = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi, &queued)) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            char* private_data = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &private_data);
+            SegmentTransfer* transfer = reinterpret_cast<SegmentTransfer*>(private_data);
+            CURLcode segment_res = msg->data.result;
+            long segment_code = 0;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &segment_code);
+            curl_multi_remove_handle(multi, msg->easy_handle);
+            curl_easy_cleanup(msg->easy_handle);
+            transfer->curl = nullptr;
+            
+            if (transfer->range_ignored) {
+                result = SegmentedResult::Unsupported;
+                stop = true;
+            } else if (!transfer->segment->complete()) {
+                if (segment_res == CURLE_OK) {
+                    segment_res = CURLE_PARTIAL_FILE;   // body ended before the range did
+                }
+                // Only this segment is retried; the others keep downloading meanwhile
+                if (!transfer->write_failed && is_transient_error(segment_res, segment_code) &&
+                    ++transfer->attempts < max_attempts) {
+                    int delay_seconds = 1 << transfer->attempts;
+                    transfer->retry_at = std::chrono::steady_clock::now() + std::chrono::seconds(delay_seconds);
+                    UI::print_warning("Connection lost (" + std::string(curl_easy_strerror(segment_res)) +
+                                      "), retrying segment in " + std::to_string(delay_seconds) + "s...");
+                } else {
+                    res = transfer->write_failed ? CURLE_WRITE_ERROR : segment_res;
+                    response_code = segment_code;
+                    result = SegmentedResult::Failed;
+                    stop = true;
+                }
+            }
+        }
         
-        // Enable progress meter
-        if (progress) {
-            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_callback_wrapper);
-            curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progress);
+        done = 0;
+        for (const auto& segment : info.segments) {
+            done += segment.done;
         }
+        job.report_progress((double)done / (double)info.size * 100.0, done, info.size);
         
-        // Set timeout (30 seconds connect, 0 = infinite transfer)
-        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 0L);
+        // Hash ranges that landed ahead of the hash position while they are still cached,
+        // a bounded amount per pass so the transfers keep being serviced
+        if (!hash.catch_up(temp_path, DownloadResume::hashable_end(info.segments, hash.pos), 16LL * 1024 * 1024)) {
+            res = CURLE_READ_ERROR;
+            result = SegmentedResult::Failed;
+            break;
+        }
         
-        // Perform download
-        res = curl_easy_perform(curl);
+        if (std::chrono::steady_clock::now() - last_save >= std::chrono::seconds(1)) {
+            info.hash_state = hash.enabled ? hash.sha.save_state() : "";
+            DownloadResume::write(meta_path, info);
+            last_save = std::chrono::steady_clock::now();
+        }
         
-        if (res == CURLE_OK) {
-            long response_code;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-            if (response_code == 200) {
-                success = true;
-            } else {
-                // Handle HTTP error codes
-                if (response_code == 404) {
-                    UI::print_error("Model file not found (404) - repository may have changed");
-                } else if (response_code >= 500) {
-                    UI::print_error("Server error (" + std::to_string(response_code) + ") - try again later");
-                } else {
-                    UI::print_error("HTTP error " + std::to_string(response_code));
-                }
-            }
+        if (in_flight > 0) {
+            curl_multi_poll(multi, nullptr, 0, 100, nullptr);
         } else {
-            // Handle curl errors
-            if (res == CURLE_COULDNT_CONNECT || res == CURLE_COULDNT_RESOLVE_HOST) {
-                UI::print_error("Network error - check your internet connection");
-            } else if (res == CURLE_OPERATION_TIMEDOUT) {
-                UI::print_error("Download timeout - try again with better connection");
-            } else {
-                UI::print_error("Download failed: " + std::string(curl_easy_strerror(res)));
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    
+    // Abort whatever is still in flight
+    for (auto& transfer : transfers) {
+        if (transfer.curl) {
+            curl_multi_remove_handle(multi, transfer.curl);
+            curl_easy_cleanup(transfer.curl);
+            transfer.curl = nullptr;
+        }
+    }
+    curl_multi_cleanup(multi);
+    close(fd);
+    
+    if (result == SegmentedResult::Done && !hash.catch_up(temp_path, info.size)) {
+        res = CURLE_READ_ERROR;
+        result = SegmentedResult::Failed;
+    }
+    info.hash_state = hash.enabled ? hash.sha.save_state() : "";
+    DownloadResume::write(meta_path, info);
+    return result;
+}
+#endif
+
+static void report_download_error(CURLcode res, long response_code, const DownloadJob& job) {
+    if (res == CURLE_ABORTED_BY_CALLBACK && job.cancel_requested()) {
+        UI::print_info("Download cancelled: " + job.model_name());
+    } else if (res == CURLE_HTTP_RETURNED_ERROR) {
+        // Handle HTTP error codes
+        if (response_code == 404) {
+            UI::print_error("Model file not found (404) - repository may have changed");
+        } else if (response_code >= 500) {
+            UI::print_error("Server error (" + std::to_string(response_code) + ") - try again later");
+        } else {
+            UI::print_error("HTTP error " + std::to_string(response_code));
+        }
+    } else if (res == CURLE_COULDNT_CONNECT || res == CURLE_COULDNT_RESOLVE_HOST) {
+        // Handle curl errors
+        UI::print_error("Network error - check your internet connection");
+    } else if (res == CURLE_OPERATION_TIMEDOUT) {
+        UI::print_error("Download timeout - try again with better connection");
+    } else if (res == CURLE_WRITE_ERROR) {
+        UI::print_error("Could not write the download to disk - is there enough free space?");
+    } else {
+        UI::print_error("Download failed: " + std::string(curl_easy_strerror(res)));
+    }
+}
+
+// Keep a download that failed verification out of models_dir, but around for inspection
+static std::string quarantine_file(const std::string& temp_path, const std::string& dest_path) {
+    size_t slash = dest_path.find_last_of("/\\");
+    std::string dir = slash == std::string::npos ? "." : dest_path.substr(0, slash);
+    std::string name = slash == std::string::npos ? dest_path : dest_path.substr(slash + 1);
+    std::string quarantine_dir = tools::FileOps::join_path(dir, "quarantine");
+    if (!tools::FileOps::dir_exists(quarantine_dir)) {
+        tools::FileOps::create_dir(quarantine_dir);
+    }
+    std::string target = tools::FileOps::join_path(quarantine_dir, name);
+    std::remove(target.c_str());
+    if (std::rename(temp_path.c_str(), target.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return "";
+    }
+    return target;
+}
+
+bool ModelManager::download_file(const std::string& url, 
+                                 const std::string& dest_path,
+                                 DownloadJob& job,
+                                 const std::string& expected_sha256) {
+    // Initialize curl (one easy handle per download, so jobs never share transfer state)
+    ensure_curl_initialized();
+    
+    // Partial data lives in "<dest>.tmp" and is kept across failures; "<dest>.tmp.meta"
+    // records which remote file it belongs to, so a later pull can continue it
+    const std::string temp_path = dest_path + ".tmp";
+    const std::string meta_path = temp_path + ".meta";
+    
+    ResumeInfo remote;
+    remote.url = url;
+    long probe_code = 0;
+    CURLcode probe = probe_remote_file(url, remote, probe_code);
+    
+    ResumeInfo saved;
+    const bool has_partial = DownloadResume::read(meta_path, saved) && file_size(temp_path) > 0;
+    if (probe != CURLE_OK && has_partial) {
+        // Unreachable: fail now rather than overwrite a partial file that cannot be validated
+        UI::print_error("Network error - check your internet connection");
+        UI::print_info("Partial download kept; pulling again resumes from where it stopped");
+        return false;
+    }
+    const bool resumable = probe == CURLE_OK && probe_code == 200 && DownloadResume::has_validator(remote);
+    const bool same_file = resumable && has_partial && DownloadResume::same_remote_file(saved, remote);
+    
+    // Verify against the registry digest, else the one Hugging Face publishes for the file
+    StreamHash hash;
+    std::string expected = expected_sha256.empty() ? remote.linked_sha256 : expected_sha256;
+    std::transform(expected.begin(), expected.end(), expected.begin(), [](unsigned char c) { return std::tolower(c); });
+    hash.enabled = !expected.empty();
+    if (hash.enabled && same_file && !saved.hash_state.empty() && hash.sha.load_state(saved.hash_state)) {
+        hash.pos = static_cast<long long>(hash.sha.bytes());
+    } else {
+        hash.reset();
+    }
+    
+    // A single-stream partial is continued from its end; a segmented one has holes, so only
+    // its recorded segments say what is on disk
+    curl_off_t offset = 0;
+    if (same_file && saved.segments.empty()) {
+        offset = file_size(temp_path);
+        if (offset > remote.size) {
+            offset = 0;
+        }
+    }
+    
+    CURLcode res = CURLE_OK;
+    long response_code = 0;
+    bool success = false;
+    bool transferred = false;
+    
+#ifndef _WIN32
+    // Large files from servers that honour ranges go over several connections
+    if (resumable && remote.accept_ranges && download_connections_ > 1 &&
+        (remote.size >= kSegmentedMinBytes || (same_file && !saved.segments.empty()))) {
+        SegmentedResult result = download_segmented(url, temp_path, meta_path, remote, same_file ? &saved : nullptr,
+                                                    offset, download_connections_, hash, job, res, response_code);
+        if (result == SegmentedResult::Unsupported) {
+            UI::print_info("Server ignored range requests; downloading over a single connection");
+            offset = 0;
+            hash.reset();
+        } else {
+            transferred = true;
+            success = result == SegmentedResult::Done;
+        }
+    }
+#endif
+    
+    if (!transferred) {
+        ResumeInfo info = remote;
+        if (offset > 0) {
+            UI::print_info("Resuming download at " + UI::format_size(offset) + " of " +
+                           UI::format_size(remote.size));
+            if (hash.enabled && hash.pos < offset) {
+                UI::print_info("Hashing the partial download...");
             }
+        } else {
+            hash.reset();
+        }
+        if (resumable) {
+            info.hash_state = hash.enabled ? hash.sha.save_state() : "";
+            DownloadResume::write(meta_path, info);
+        } else {
+            std::remove(meta_path.c_str());
         }
         
-        // Cleanup
-        curl_easy_cleanup(curl);
+        if (resumable && offset == remote.size) {
+            // Already complete on disk; only the rename was missing
+            success = hash.catch_up(temp_path, offset);
+            res = success ? CURLE_OK : CURLE_READ_ERROR;
+        } else {
+            success = download_single_stream(url, temp_path, meta_path, resumable ? &info : nullptr, offset,
+                                             hash, job, res, response_code);
+        }
+    }
+    
+    if (!success) {
+        report_download_error(res, response_code, job);
     }
     
-    curl_global_cleanup();
-    file.close();
+    // Reject corrupt or truncated data before it can be loaded as a model
+    if (success && hash.enabled) {
+        hash.reader.close();
+        std::string actual = hash.pos == file_size(temp_path) ? hash.sha.hex_digest() : "";
+        if (actual != expected) {
+            UI::print_error("Checksum mismatch for " + dest_path);
+            UI::print_info("Expected SHA-256: " + expected);
+            UI::print_info("Actual SHA-256:   " + (actual.empty() ? std::string("(incomplete)") : actual));
+            std::string quarantined = quarantine_file(temp_path, dest_path);
+            if (!quarantined.empty()) {
+                UI::print_info("Corrupt download moved to: " + quarantined);
+            }
+            std::remove(meta_path.c_str());
+            return false;
+        }
+        UI::print_info("SHA-256 verified");
+    }
     
     // Move temp file to destination if successful
     if (success) {
+        std::remove(meta_path.c_str());
+        
         // Remove any existing file at destination
         std::remove(dest_path.c_str());
         
@@ -2341,9 +3150,13 @@ bool ModelManager::download_file(const std::string& url,
                 success = false;
             }
         }
-    } else {
-        // Remove temp file on failure
+    } else if (!resumable || (res == CURLE_HTTP_RETURNED_ERROR && response_code < 500)) {
+        // Nothing worth keeping: the file cannot be resumed, or the server rejected the request
+        // (416 included, i.e. the partial file no longer fits the remote one)
         std::remove(temp_path.c_str());
+        std::remove(meta_path.c_str());
+    } else {
+        UI::print_info("Partial download kept; pulling again resumes from where it stopped");
     }
     
     return success;
@@ -2356,6 +3169,45 @@ bool ModelManager::pull_model(const std::string& model_name, const std::string&
         // Future: allow override of quantization format
     }
     
+    DownloadJob job(model_name, progress_callback_);
+    return pull_model(job);
+}
+
+bool ModelManager::pull_model(DownloadJob& job) {
+    if (job.cancel_requested()) {
+        job.finish(false);
+        return false;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(g_active_downloads_mutex);
+        g_active_downloads.push_back(&job);
+    }
+    job.start();
+    
+    // The job must always leave the active list and finish, or cancel_download() would
+    // reach a destroyed job and wait() would never return
+    bool success = false;
+    std::string error;
+    try {
+        success = pull_registry_model(job);
+    } catch (const std::exception& e) {
+        error = e.what();
+        UI::print_error("Download failed: " + error);
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(g_active_downloads_mutex);
+        g_active_downloads.erase(std::remove(g_active_downloads.begin(), g_active_downloads.end(), &job),
+                                 g_active_downloads.end());
+    }
+    job.finish(success, error);
+    return success;
+}
+
+bool ModelManager::pull_registry_model(DownloadJob& job) {
+    const std::string& model_name = job.model_name();
+    
     // Check if model exists in registry
     if (!is_in_registry(model_name)) {
         UI::print_error("Model '" + model_name + "' not found in registry");
@@ -2371,7 +3223,7 @@ bool ModelManager::pull_model(const std::string& model_name, const std::string&
         UI::print_info("Model '" + model_name + "' already exists locally");
         std::string path = get_model_path(model_name);
         UI::print_info("Path: " + path);
-        return true;
+        return pull_mmproj(entry, path, job);
     }
     
     // Construct download URL
@@ -2400,14 +3252,18 @@ bool ModelManager::pull_model(const std::string& model_name, const std::string&
     // Download with progress
     UI::print_info("Downloading... (this may take a while)");
     
-    bool success = download_file(url, dest_path, progress_callback_);
+    bool success = download_file(url, dest_path, job, entry.sha256);
     
     if (success) {
         std::cout << std::endl;
         UI::print_success("Download complete!");
         UI::print_info("Model saved to: " + dest_path);
+        pull_mmproj(entry, dest_path, job);
         UI::print_info("You can now use: delta --model " + model_name);
         return true;
+    } else if (job.cancel_requested()) {
+        std::cout << std::endl;
+        return false;
     } else {
         std::cout << std::endl;
         UI::print_error("Download failed");
@@ -2417,6 +3273,24 @@ bool ModelManager::pull_model(const std::string& model_name, const std::string&
     }
 }
 
+bool ModelManager::pull_mmproj(const ModelRegistry& entry, const std::string& model_path, DownloadJob& job) {
+    std::string mmproj_path = get_mmproj_path(model_path);
+    if (entry.mmproj_filename.empty() || tools::FileOps::file_exists(mmproj_path)) {
+        return true;
+    }
+    
+    // The model still works for text if the projector cannot be fetched
+    UI::print_info("Downloading vision projector: " + entry.mmproj_filename);
+    if (!download_file(get_hf_url(entry.repo_id, entry.mmproj_filename), mmproj_path, job)) {
+        std::cout << std::endl;
+        UI::print_warning("Vision projector download failed; image input will be unavailable");
+        return true;
+    }
+    std::cout << std::endl;
+    UI::print_info("Projector saved to: " + mmproj_path);
+    return true;
+}
+
 // ============================================================================
 // DEFAULT MODEL SUPPORT
 // ============================================================================
@@ -2506,5 +3380,172 @@ std::string ModelManager::get_auto_selected_model() {
     return default_short;
 }
 
+// ============================================================================
+// Download jobs and scheduling
+// ============================================================================
+
+DownloadJob::DownloadJob(const std::string& model_name, ModelManager::ProgressCallback progress)
+    : model_name_(model_name), progress_callback_(std::move(progress)) {
+}
+
+DownloadJob::State DownloadJob::state() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return state_;
+}
+
+bool DownloadJob::finished() const {
+    State current = state();
+    return current != State::Queued && current != State::Running;
+}
+
+bool DownloadJob::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    finished_cv_.wait(lock, [this]() { return state_ != State::Queued && state_ != State::Running; });
+    return state_ == State::Completed;
+}
+
+std::string DownloadJob::error() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+}
+
+void DownloadJob::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    state_ = State::Running;
+}
+
+void DownloadJob::report_progress(double progress, long long current, long long total) {
+    progress_.store(progress);
+    current_bytes_.store(current);
+    total_bytes_.store(total);
+    if (progress_callback_) {
+        progress_callback_(progress, current, total);
+    }
+}
+
+void DownloadJob::finish(bool success, const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = error;
+        if (success) {
+            state_ = State::Completed;
+        } else {
+            state_ = cancel_requested() ? State::Cancelled : State::Failed;
+        }
+    }
+    finished_cv_.notify_all();
+}
+
+DownloadScheduler::DownloadScheduler(ModelManager& manager, size_t max_concurrent)
+    : manager_(manager) {
+    max_concurrent = std::max<size_t>(1, max_concurrent);
+    workers_.reserve(max_concurrent);
+    for (size_t i = 0; i < max_concurrent; i++) {
+        workers_.emplace_back(&DownloadScheduler::worker_loop, this);
+    }
+}
+
+DownloadScheduler::~DownloadScheduler() {
+    cancel_all();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    queue_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+std::string DownloadScheduler::job_key(const std::string& model_name) const {
+    // "qwen3:0.6b" and "qwen3-0.6b" are the same file; key on it so they share one job
+    if (manager_.is_in_registry(model_name)) {
+        return manager_.get_registry_entry(model_name).filename;
+    }
+    return model_name;
+}
+
+std::shared_ptr<DownloadJob> DownloadScheduler::submit(const std::string& model_name,
+                                                       ModelManager::ProgressCallback progress,
+                                                       FinishCallback on_finish) {
+    const std::string key = job_key(model_name);
+    std::shared_ptr<DownloadJob> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = active_.find(key);
+        if (it != active_.end()) {
+            return it->second;
+        }
+        job = std::make_shared<DownloadJob>(model_name, std::move(progress));
+        active_[key] = job;
+        queue_.push_back(Entry{job, std::move(on_finish)});
+        pending_++;
+    }
+    queue_cv_.notify_one();
+    return job;
+}
+
+std::shared_ptr<DownloadJob> DownloadScheduler::find(const std::string& model_name) const {
+    const std::string key = job_key(model_name);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = active_.find(key);
+    return it != active_.end() ? it->second : nullptr;
+}
+
+bool DownloadScheduler::cancel(const std::string& model_name) {
+    std::shared_ptr<DownloadJob> job = find(model_name);
+    if (!job) {
+        return false;
+    }
+    job->cancel();
+    return true;
+}
+
+void DownloadScheduler::cancel_all() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : active_) {
+        entry.second->cancel();
+    }
+}
+
+void DownloadScheduler::wait_all() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this]() { return pending_ == 0; });
+}
+
+void DownloadScheduler::worker_loop() {
+    for (;;) {
+        Entry entry;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queue_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;     // stopping, and every queued job has been drained
+            }
+            entry = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        
+        // A job cancelled while queued finishes here without touching the network
+        manager_.pull_model(*entry.job);
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = active_.find(job_key(entry.job->model_name()));
+            if (it != active_.end() && it->second == entry.job) {
+                active_.erase(it);
+            }
+        }
+        if (entry.on_finish) {
+            entry.on_finish(*entry.job);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_--;
+        }
+        idle_cv_.notify_all();
+    }
+}
+
 } // namespace delta
 
@@ -19,11 +19,15 @@
     #include <dirent.h>
     #include <pwd.h>
     #include <libgen.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
 #else
     #include <unistd.h>
     #include <dirent.h>
     #include <pwd.h>
     #include <libgen.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
 #endif
 
 namespace delta {
@@ -145,6 +149,41 @@ std::string FileOps::absolute_path(const std::string& path) {
 #endif
 }
 
+bool FileOps::prefetch_file(const std::string& path) {
+#ifdef _WIN32
+    (void)path;
+    return false;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    
+    bool ok = false;
+#if defined(__linux__) || defined(__ANDROID__)
+    // Kick off asynchronous readahead of the whole file into the page cache
+    ok = posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0;
+#endif
+    // The page cache is shared with the loader's own mapping, so hinting
+    // through a temporary mapping is enough; the pages outlive munmap().
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) {
+        ok = madvise(addr, size, MADV_WILLNEED) == 0 || ok;
+        munmap(addr, size);
+    }
+    
+    close(fd);
+    return ok;
+#endif
+}
+
 std::string FileOps::get_home_dir() {
 #ifdef _WIN32
     char path[MAX_PATH];
@@ -0,0 +1,206 @@
+/**
+ * Hashing Utilities for Delta CLI
+ * Non-cryptographic hashes used to key on-disk caches, and SHA-256 for
+ * verifying downloaded models
+ */
+
+#include "../delta_cli.h"
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace delta {
+namespace tools {
+
+uint64_t Hash::fnv1a64(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string Hash::to_hex(uint64_t value) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(value));
+    return std::string(buf);
+}
+
+std::string Hash::file_fingerprint(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return "";
+    }
+
+    // Model files are several GB: hash the size plus the first and last MiB
+    // instead of the whole file. GGUF headers and tensor tails differ between
+    // any two models or quantizations, so this is enough to tell them apart.
+    const uint64_t size = static_cast<uint64_t>(file.tellg());
+    uint64_t hash = fnv1a64(&size, sizeof(size));
+
+    const size_t window = 1024 * 1024;
+    std::vector<char> buf(window);
+
+    file.seekg(0);
+    file.read(buf.data(), static_cast<std::streamsize>(std::min<uint64_t>(size, window)));
+    hash = fnv1a64(buf.data(), static_cast<size_t>(file.gcount()), hash);
+
+    if (size > window) {
+        file.seekg(static_cast<std::streamoff>(size - window));
+        file.read(buf.data(), static_cast<std::streamsize>(window));
+        hash = fnv1a64(buf.data(), static_cast<size_t>(file.gcount()), hash);
+    }
+
+    return to_hex(hash);
+}
+
+static const uint32_t kSha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+Sha256::Sha256() {
+    static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    std::memcpy(h_, init, sizeof(h_));
+}
+
+void Sha256::transform(const unsigned char* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) |
+               (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + kSha256K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d;
+    h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+}
+
+void Sha256::update(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    length_ += size;
+    
+    if (buffer_len_ > 0) {
+        size_t take = std::min(size, sizeof(buffer_) - buffer_len_);
+        std::memcpy(buffer_ + buffer_len_, bytes, take);
+        buffer_len_ += take;
+        bytes += take;
+        size -= take;
+        if (buffer_len_ < sizeof(buffer_)) {
+            return;
+        }
+        transform(buffer_);
+        buffer_len_ = 0;
+    }
+    // Whole blocks straight from the caller's buffer
+    for (; size >= 64; bytes += 64, size -= 64) {
+        transform(bytes);
+    }
+    std::memcpy(buffer_, bytes, size);
+    buffer_len_ = size;
+}
+
+std::string Sha256::hex_digest() const {
+    // Pad a copy, so the running hash is left untouched
+    Sha256 copy = *this;
+    const uint64_t bit_length = length_ * 8;
+    const unsigned char pad = 0x80;
+    const unsigned char zero = 0x00;
+    copy.update(&pad, 1);
+    while (copy.buffer_len_ != 56) {
+        copy.update(&zero, 1);
+    }
+    unsigned char length_bytes[8];
+    for (int i = 0; i < 8; i++) {
+        length_bytes[i] = static_cast<unsigned char>(bit_length >> (56 - 8 * i));
+    }
+    copy.update(length_bytes, sizeof(length_bytes));
+    
+    char hex[65];
+    for (int i = 0; i < 8; i++) {
+        snprintf(hex + i * 8, 9, "%08x", copy.h_[i]);
+    }
+    return std::string(hex, 64);
+}
+
+std::string Sha256::save_state() const {
+    // "<length> <h0..h7 as hex>[ <buffered bytes as hex>]"
+    std::ostringstream out;
+    out << length_ << ' ';
+    char word[9];
+    for (uint32_t value : h_) {
+        snprintf(word, sizeof(word), "%08x", value);
+        out << word;
+    }
+    if (buffer_len_ > 0) {
+        out << ' ';
+    }
+    for (size_t i = 0; i < buffer_len_; i++) {
+        snprintf(word, sizeof(word), "%02x", buffer_[i]);
+        out << word;
+    }
+    return out.str();
+}
+
+bool Sha256::load_state(const std::string& state) {
+    std::istringstream in(state);
+    uint64_t length = 0;
+    std::string words;
+    std::string buffered;
+    if (!(in >> length >> words) || words.size() != 64) {
+        return false;
+    }
+    in >> buffered;     // empty when the state is block-aligned
+    if (buffered.size() % 2 != 0 || buffered.size() / 2 != length % 64) {
+        return false;
+    }
+    
+    try {
+        for (int i = 0; i < 8; i++) {
+            h_[i] = static_cast<uint32_t>(std::stoul(words.substr(i * 8, 8), nullptr, 16));
+        }
+        for (size_t i = 0; i < buffered.size() / 2; i++) {
+            buffer_[i] = static_cast<unsigned char>(std::stoul(buffered.substr(i * 2, 2), nullptr, 16));
+        }
+    } catch (...) {
+        return false;
+    }
+    buffer_len_ = buffered.size() / 2;
+    length_ = length;
+    return true;
+}
+
+} // namespace tools
+} // namespace delta
@@ -0,0 +1,141 @@
+/**
+ * llama-server Flag Probing for Delta CLI
+ * Detects which options the installed server binary understands
+ */
+
+#include "../delta_cli.h"
+#include <array>
+#include <mutex>
+
+namespace delta {
+namespace tools {
+
+static std::string read_help_text(const std::string& server_bin) {
+    std::string command = "\"" + server_bin + "\" --help 2>&1";
+#ifdef _WIN32
+    FILE* pipe = _popen(command.c_str(), "r");
+#else
+    FILE* pipe = popen(command.c_str(), "r");
+#endif
+    if (!pipe) {
+        return "";
+    }
+
+    std::string output;
+    std::array<char, 256> buffer;
+    while (fgets(buffer.data(), static_cast<int>(buffer.size()), pipe) != nullptr) {
+        output += buffer.data();
+    }
+#ifdef _WIN32
+    _pclose(pipe);
+#else
+    pclose(pipe);
+#endif
+    return output;
+}
+
+// Help text per server binary; probing costs a process start, so do it once
+static std::string help_text(const std::string& server_bin) {
+    static std::mutex mutex;
+    static std::map<std::string, std::string> cache;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cache.find(server_bin);
+    if (it == cache.end()) {
+        it = cache.emplace(server_bin, read_help_text(server_bin)).first;
+    }
+    return it->second;
+}
+
+bool ServerFlags::supports(const std::string& server_bin, const std::string& flag) {
+    if (server_bin.empty() || flag.empty()) {
+        return false;
+    }
+    const std::string help = help_text(server_bin);
+
+    // Match whole options only: "--flash-attn" must not match "--flash-attn-foo"
+    for (size_t pos = help.find(flag); pos != std::string::npos; pos = help.find(flag, pos + 1)) {
+        const size_t end = pos + flag.size();
+        if (end == help.size() || help[end] == ' ' || help[end] == ',' || help[end] == '\t' ||
+            help[end] == '\n' || help[end] == '\r' || help[end] == '=') {
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* ServerFlags::kv_cache_type_name(KvCacheType type) {
+    switch (type) {
+        case KvCacheType::Q8_0: return "q8_0";
+        case KvCacheType::Q4_0: return "q4_0";
+        default:                return "f16";
+    }
+}
+
+bool ServerFlags::parse_kv_cache_type(const std::string& name, KvCacheType& type) {
+    if (name == "f16") {
+        type = KvCacheType::F16;
+    } else if (name == "q8_0") {
+        type = KvCacheType::Q8_0;
+    } else if (name == "q4_0") {
+        type = KvCacheType::Q4_0;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* ServerFlags::flash_attn_name(FlashAttention mode) {
+    switch (mode) {
+        case FlashAttention::On:  return "on";
+        case FlashAttention::Off: return "off";
+        default:                  return "auto";
+    }
+}
+
+bool ServerFlags::parse_flash_attn(const std::string& name, FlashAttention& mode) {
+    if (name == "auto") {
+        mode = FlashAttention::Auto;
+    } else if (name == "on" || name == "1" || name == "true") {
+        mode = FlashAttention::On;
+    } else if (name == "off" || name == "0" || name == "false") {
+        mode = FlashAttention::Off;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string ServerFlags::kv_cache_args(const std::string& server_bin, KvCacheType type_k, KvCacheType type_v,
+                                       FlashAttention flash_attn) {
+    const bool has_flash_attn = supports(server_bin, "--flash-attn");
+
+    // llama.cpp can only use a quantized V cache inside the flash attention kernel
+    if (type_v != KvCacheType::F16) {
+        if (flash_attn == FlashAttention::Off || !has_flash_attn) {
+            type_v = KvCacheType::F16;
+        } else {
+            flash_attn = FlashAttention::On;
+        }
+    }
+
+    std::string args;
+    if (has_flash_attn && flash_attn != FlashAttention::Auto) {
+        // Older builds take a bare switch instead of on|off|auto
+        if (help_text(server_bin).find("on|off|auto") != std::string::npos) {
+            args += " --flash-attn " + std::string(flash_attn_name(flash_attn));
+        } else if (flash_attn == FlashAttention::On) {
+            args += " --flash-attn";
+        }
+    }
+    if (type_k != KvCacheType::F16 && supports(server_bin, "--cache-type-k")) {
+        args += " --cache-type-k " + std::string(kv_cache_type_name(type_k));
+    }
+    if (type_v != KvCacheType::F16 && supports(server_bin, "--cache-type-v")) {
+        args += " --cache-type-v " + std::string(kv_cache_type_name(type_v));
+    }
+    return args;
+}
+
+} // namespace tools
+} // namespace delta
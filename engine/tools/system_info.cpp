@@ -0,0 +1,188 @@
+/**
+ * System Information Tool for Delta CLI
+ * CPU topology detection used to choose thread and NUMA defaults
+ */
+
+#include "../delta_cli.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <set>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+    #include <windows.h>
+#elif defined(__APPLE__)
+    #include <sys/types.h>
+    #include <sys/sysctl.h>
+#else
+    #include <sched.h>
+#endif
+
+namespace delta {
+namespace tools {
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+// True for names like "cpu12" / "node0" (but not "cpufreq")
+static bool is_numbered_entry(const std::string& name, const std::string& prefix) {
+    if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+    return std::all_of(name.begin() + prefix.size(), name.end(), [](char c) {
+        return std::isdigit(static_cast<unsigned char>(c)) != 0;
+    });
+}
+
+static int read_int_file(const std::string& path, int fallback) {
+    std::string content = FileOps::read_file(path);
+    if (content.empty()) {
+        return fallback;
+    }
+    return std::atoi(content.c_str());
+}
+#endif
+
+static SystemInfo::CpuTopology detect_cpu_topology() {
+    SystemInfo::CpuTopology topology;
+    int hw_threads = static_cast<int>(std::thread::hardware_concurrency());
+    topology.logical_cores = hw_threads > 0 ? hw_threads : 1;
+    topology.physical_cores = topology.logical_cores;
+
+#ifdef _WIN32
+    DWORD length = 0;
+    GetLogicalProcessorInformation(nullptr, &length);
+    if (length > 0) {
+        std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+        if (GetLogicalProcessorInformation(info.data(), &length)) {
+            int cores = 0;
+            int nodes = 0;
+            for (const auto& entry : info) {
+                if (entry.Relationship == RelationProcessorCore) {
+                    cores++;
+                } else if (entry.Relationship == RelationNumaNode) {
+                    nodes++;
+                }
+            }
+            if (cores > 0) {
+                topology.physical_cores = cores;
+            }
+            if (nodes > 0) {
+                topology.numa_nodes = nodes;
+            }
+        }
+    }
+#elif defined(__APPLE__)
+    int value = 0;
+    size_t size = sizeof(value);
+    if (sysctlbyname("hw.physicalcpu", &value, &size, nullptr, 0) == 0 && value > 0) {
+        topology.physical_cores = value;
+    }
+    size = sizeof(value);
+    if (sysctlbyname("hw.logicalcpu", &value, &size, nullptr, 0) == 0 && value > 0) {
+        topology.logical_cores = value;
+    }
+#else
+    // Physical cores are the distinct (package, core) pairs among the CPUs in /sys
+    const std::string cpu_root = "/sys/devices/system/cpu";
+    std::set<std::pair<int, int>> cores;
+    int logical = 0;
+    for (const auto& name : FileOps::list_dir(cpu_root)) {
+        if (!is_numbered_entry(name, "cpu")) {
+            continue;
+        }
+        std::string topology_dir = FileOps::join_path(FileOps::join_path(cpu_root, name), "topology");
+        int core_id = read_int_file(FileOps::join_path(topology_dir, "core_id"), -1);
+        if (core_id < 0) {
+            continue;   // offline CPU
+        }
+        int package_id = read_int_file(FileOps::join_path(topology_dir, "physical_package_id"), 0);
+        cores.insert(std::make_pair(package_id, core_id));
+        logical++;
+    }
+    if (logical > 0) {
+        topology.logical_cores = logical;
+        topology.physical_cores = static_cast<int>(cores.size());
+    }
+
+    // Containers and taskset restrict us to fewer CPUs than the machine has
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0) {
+        int allowed = CPU_COUNT(&affinity);
+        if (allowed > 0 && allowed < topology.logical_cores) {
+            int smt = std::max(1, topology.logical_cores / std::max(1, topology.physical_cores));
+            topology.logical_cores = allowed;
+            topology.physical_cores = std::max(1, allowed / smt);
+        }
+    }
+
+    int nodes = 0;
+    for (const auto& name : FileOps::list_dir("/sys/devices/system/node")) {
+        if (is_numbered_entry(name, "node")) {
+            nodes++;
+        }
+    }
+    if (nodes > 0) {
+        topology.numa_nodes = nodes;
+    }
+#endif
+
+    topology.physical_cores = std::max(1, std::min(topology.physical_cores, topology.logical_cores));
+    return topology;
+}
+
+const SystemInfo::CpuTopology& SystemInfo::cpu_topology() {
+    static const CpuTopology topology = detect_cpu_topology();
+    return topology;
+}
+
+int SystemInfo::default_threads() {
+    return cpu_topology().physical_cores;
+}
+
+int SystemInfo::default_threads_batch() {
+    return cpu_topology().logical_cores;
+}
+
+const char* SystemInfo::numa_strategy_name(NumaStrategy strategy) {
+    switch (strategy) {
+        case NumaStrategy::Distribute: return "distribute";
+        case NumaStrategy::Isolate:    return "isolate";
+        case NumaStrategy::Numactl:    return "numactl";
+        default:                       return "";
+    }
+}
+
+bool SystemInfo::parse_numa_strategy(const std::string& name, NumaStrategy& strategy) {
+    if (name == "distribute") {
+        strategy = NumaStrategy::Distribute;
+    } else if (name == "isolate") {
+        strategy = NumaStrategy::Isolate;
+    } else if (name == "numactl") {
+        strategy = NumaStrategy::Numactl;
+    } else if (name == "off" || name == "disabled" || name == "none") {
+        strategy = NumaStrategy::Disabled;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string SystemInfo::llama_server_thread_args(int n_threads, int n_threads_batch, NumaStrategy numa) {
+    if (n_threads <= 0) {
+        n_threads = default_threads();
+    }
+    if (n_threads_batch <= 0) {
+        n_threads_batch = default_threads_batch();
+    }
+    std::string args = " --threads " + std::to_string(n_threads) +
+                       " --threads-batch " + std::to_string(n_threads_batch);
+    if (numa != NumaStrategy::Disabled) {
+        args += " --numa " + std::string(numa_strategy_name(numa));
+    }
+    return args;
+}
+
+} // namespace tools
+} // namespace delta
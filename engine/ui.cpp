@@ -10,6 +10,9 @@
 #include <iomanip>
 #include <sstream>
 #include <ctime>
+#include <chrono>
+#include <mutex>
+#include <map>
 #ifdef _WIN32
     #include <windows.h>
     #include <io.h>
@@ -181,6 +184,46 @@ std::string UI::get_input() {
     return input;
 }
 
+// Redraws per second for the download progress line
+static const int kProgressFps = 10;
+
+void UI::print_download_progress(double progress, long long current, long long total, const std::string& label) {
+    // One frame limiter per label, so concurrent downloads do not starve each other
+    static std::mutex mutex;
+    static std::map<std::string, std::chrono::steady_clock::time_point> last_frames;
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto now = std::chrono::steady_clock::now();
+    if (progress >= 100.0) {
+        last_frames.erase(label);
+    } else {
+        auto it = last_frames.find(label);
+        if (it != last_frames.end() && now - it->second < std::chrono::milliseconds(1000 / kProgressFps)) {
+            return;
+        }
+        last_frames[label] = now;
+    }
+    
+    // Build the whole line first so each frame is a single write (ASCII bar on
+    // Windows to avoid garbled output)
+    const int bar_width = 50;
+    const int pos = static_cast<int>(progress / 100.0 * bar_width);
+    std::string line = label.empty() ? "\r  [" : "\r" + label + " [";
+    for (int i = 0; i < bar_width; i++) {
+#ifdef _WIN32
+        line += i < pos ? "#" : (i == pos ? ">" : "-");
+#else
+        line += i < pos ? "█" : (i == pos ? "▓" : "░");
+#endif
+    }
+    
+    char numbers[96];
+    snprintf(numbers, sizeof(numbers), "] %.1f%% (%.1f / %.1f MB)", progress,
+             current / (1024.0 * 1024.0), total / (1024.0 * 1024.0));
+    line += numbers;
+    std::cout << line << std::flush;
+}
+
 // ============================================================================
 // INTERNATIONALIZATION SUPPORT
 // ============================================================================
@@ -0,0 +1,91 @@
+/**
+ * Allocation Tests
+ *
+ * Replaces the global operator new to count heap allocations, so it is built as
+ * its own executable instead of affecting the main test binary.
+ */
+
+#include <catch2/catch_test_macros.hpp>
+#include "../src/delta_cli.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace delta;
+
+static std::atomic<size_t> g_allocation_count{0};
+
+void* operator new(size_t size) {
+    g_allocation_count++;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// Records the allocation count once the first few tokens are out and again when
+// generation finishes; does not allocate itself
+class AllocationCountingSink : public TokenSink {
+public:
+    static const int kWarmupTokens = 4;
+    
+    void on_token(const TokenEvent& event) override {
+        n_tokens = event.index + 1;
+        if (n_tokens == kWarmupTokens) {
+            at_warmup = g_allocation_count.load();
+        }
+    }
+    
+    void on_finish() override {
+        at_finish = g_allocation_count.load();
+    }
+    
+    int n_tokens = 0;
+    size_t at_warmup = 0;
+    size_t at_finish = 0;
+};
+
+TEST_CASE("Generation helpers do not allocate", "[inference][allocations]") {
+    RepetitionDetector detector;
+    detector.configure(12, 2, 256);
+    IncrementalDetokenizer detok;
+    detok.push("warm up the buffer");
+    
+    const size_t before = g_allocation_count.load();
+    for (int i = 0; i < 100000; i++) {
+        detector.push(i % 5000);
+        detok.push("tok");
+    }
+    REQUIRE(g_allocation_count.load() == before);
+}
+
+// Runs the real token loop; needs a model, given by DELTA_TEST_MODEL
+TEST_CASE("Generation loop does not allocate per token", "[inference][allocations][integration]") {
+    const char* model_path = std::getenv("DELTA_TEST_MODEL");
+    if (!model_path || !*model_path) {
+        WARN("DELTA_TEST_MODEL not set, skipping");
+        return;
+    }
+    
+    InferenceConfig config;
+    config.model_path = model_path;
+    config.n_ctx = 512;
+    config.sentence_stop_tokens = 0;
+    InferenceEngine engine;
+    REQUIRE(engine.load_model(config));
+    
+    // Unconstrained only: llama.cpp's grammar sampler allocates its own stacks per token
+    AllocationCountingSink sink;
+    engine.generate("Write a long story about the sea.", 64, sink);
+    INFO("tokens: " << sink.n_tokens);
+    REQUIRE(sink.n_tokens > AllocationCountingSink::kWarmupTokens);
+    REQUIRE(sink.at_finish == sink.at_warmup);
+}
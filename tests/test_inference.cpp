@@ -3,7 +3,9 @@
  */
 
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include "../src/delta_cli.h"
+#include <nlohmann/json.hpp>
 
 using namespace delta;
 
@@ -25,11 +27,24 @@ TEST_CASE("InferenceConfig defaults", "[inference]") {
         InferenceConfig config;
         REQUIRE(config.n_ctx == 4096);
         REQUIRE(config.n_batch == 512);
-        REQUIRE(config.n_threads == 4);
+        REQUIRE(config.n_ubatch <= config.n_batch);
+        REQUIRE(config.n_threads == 0);        // resolved from CPU topology at load
+        REQUIRE(config.n_threads_batch == 0);
+        REQUIRE(config.numa == NumaStrategy::Disabled);
+        REQUIRE(config.kv_type_k == KvCacheType::F16);
+        REQUIRE(config.kv_type_v == KvCacheType::F16);
+        REQUIRE(config.flash_attn == FlashAttention::Auto);
         REQUIRE(config.n_gpu_layers == 0);
         REQUIRE(config.temperature > 0.0f);
         REQUIRE(config.use_mmap == true);
+        REQUIRE(config.warmup == true);
         REQUIRE(config.multimodal == false);
+        REQUIRE(config.n_parallel == 1);
+        REQUIRE(config.draft_model_path.empty());
+        REQUIRE(config.n_draft > 0);
+        REQUIRE(config.lookup_ngram == 0);
+        REQUIRE(config.context_shift == false);
+        REQUIRE(config.n_keep >= 0);
     }
 }
 
@@ -69,9 +84,26 @@ TEST_CASE("InferenceEngine generation", "[inference]") {
         REQUIRE_THROWS(engine.generate("test prompt"));
     }
     
-    SECTION("generate_multimodal() not yet implemented") {
+    SECTION("generate_batch() requires loaded model") {
+        std::vector<std::string> prompts = {"first prompt", "second prompt"};
+        REQUIRE_THROWS(engine.generate_batch(prompts));
+    }
+    
+    SECTION("Streaming generate_batch() requires loaded model") {
+        bool pulled = false;
+        REQUIRE_THROWS(engine.generate_batch(
+            [&](size_t&, std::vector<int>&) { pulled = true; return false; },
+            [](BatchResult&&) {}));
+        REQUIRE_FALSE(pulled);
+    }
+    
+    SECTION("generate_multimodal() requires loaded model") {
         std::vector<std::string> images;
         REQUIRE_THROWS(engine.generate_multimodal("prompt", images));
+        
+        images.push_back("screenshot.png");
+        REQUIRE_THROWS_AS(engine.generate_multimodal("prompt", images), std::runtime_error);
+        REQUIRE(engine.has_vision() == false);
     }
 }
 
@@ -94,6 +126,253 @@ TEST_CASE("InferenceEngine info methods", "[inference]") {
     }
 }
 
+TEST_CASE("InferenceEngine KV cache reuse", "[inference]") {
+    InferenceEngine engine;
+    
+    SECTION("reset_cache() is safe on an unloaded engine") {
+        REQUIRE_NOTHROW(engine.reset_cache());
+    }
+    
+    SECTION("Stats are empty before any generation") {
+        const GenerationStats& stats = engine.get_last_stats();
+        REQUIRE(stats.n_prompt_tokens == 0);
+        REQUIRE(stats.n_reused_tokens == 0);
+        REQUIRE(stats.n_generated_tokens == 0);
+        REQUIRE(stats.n_drafted == 0);
+        REQUIRE(stats.draft_acceptance_rate() == 0.0);
+    }
+    
+    SECTION("No draft model without a loaded model") {
+        REQUIRE(engine.has_draft_model() == false);
+    }
+}
+
+TEST_CASE("InferenceEngine embeddings", "[inference]") {
+    InferenceEngine engine;
+    
+    SECTION("embed() throws when no model is loaded") {
+        REQUIRE_THROWS_AS(engine.embed({"hello", "world"}), std::runtime_error);
+    }
+    
+    SECTION("rerank() throws when no model is loaded") {
+        REQUIRE_THROWS_AS(engine.rerank("query", {"doc a", "doc b"}), std::runtime_error);
+    }
+    
+    SECTION("EmbeddingMatrix rows index into contiguous storage") {
+        EmbeddingMatrix matrix;
+        matrix.rows = 2;
+        matrix.dim = 3;
+        matrix.data = {1, 2, 3, 4, 5, 6};
+        REQUIRE(matrix.row(1)[0] == 4);
+        REQUIRE(matrix.row(1) == matrix.row(0) + 3);
+    }
+}
+
+TEST_CASE("TokenSink implementations", "[inference]") {
+    TokenEvent event;
+    
+    SECTION("StringTokenSink collects pieces in order") {
+        StringTokenSink sink;
+        event.piece = "Hello";
+        sink.on_token(event);
+        event.piece = ", world";
+        sink.on_token(event);
+        sink.on_finish();
+        REQUIRE(sink.text() == "Hello, world");
+        REQUIRE(sink.take() == "Hello, world");
+    }
+    
+    SECTION("Sinks do not request logprobs by default") {
+        StringTokenSink sink;
+        REQUIRE(sink.wants_logprobs() == false);
+    }
+    
+    SECTION("Prefill progress does not cancel by default") {
+        StringTokenSink sink;
+        REQUIRE(sink.on_prefill_progress(512, 2048, 100.0) == true);
+    }
+    
+    SECTION("generate() with a sink throws when no model is loaded") {
+        InferenceEngine engine;
+        StringTokenSink sink;
+        REQUIRE_THROWS_AS(engine.generate("test", 10, sink), std::runtime_error);
+        REQUIRE(sink.text().empty());
+    }
+}
+
+TEST_CASE("IncrementalDetokenizer UTF-8 handling", "[inference]") {
+    IncrementalDetokenizer detok;
+    const std::string euro = "\xE2\x82\xAC";
+    
+    SECTION("ASCII passes straight through") {
+        REQUIRE(detok.push("Hello") == "Hello");
+        REQUIRE(detok.push(" world") == " world");
+        REQUIRE(detok.flush().empty());
+    }
+    
+    SECTION("Split multi-byte characters are held back until complete") {
+        REQUIRE(detok.push(euro.substr(0, 1)).empty());
+        REQUIRE(detok.push(euro.substr(1, 1)).empty());
+        REQUIRE(detok.push(euro.substr(2) + "!") == euro + "!");
+    }
+    
+    SECTION("flush() returns an incomplete trailing sequence") {
+        REQUIRE(detok.push("a\xF0\x9F") == "a");
+        REQUIRE(detok.flush() == "\xF0\x9F");
+        detok.reset();
+        REQUIRE(detok.push("b") == "b");
+    }
+}
+
+TEST_CASE("RepetitionDetector token n-grams", "[inference]") {
+    RepetitionDetector detector;
+    detector.configure(4, 2, 16);
+    
+    SECTION("Distinct tokens never trigger") {
+        for (int token = 0; token < 1000; token++) {
+            REQUIRE(detector.push(token) == false);
+        }
+    }
+    
+    SECTION("A block repeated back to back triggers when the copy completes") {
+        for (int token : {1, 2, 3, 4, 5, 6}) {
+            REQUIRE(detector.push(token) == false);
+        }
+        for (int token : {1, 2, 3, 4, 5}) {
+            REQUIRE(detector.push(token) == false);
+        }
+        REQUIRE(detector.push(6) == true);
+    }
+    
+    SECTION("Repeats with other tokens in between are ignored") {
+        for (int token : {1, 2, 3, 4, 5, 6, 1, 2, 3, 4, 7, 8, 1, 2, 3, 4}) {
+            REQUIRE(detector.push(token) == false);
+        }
+    }
+    
+    SECTION("Repeats outside the window are ignored") {
+        for (int token : {1, 2, 3, 4}) {
+            detector.push(token);
+        }
+        for (int token = 100; token < 130; token++) {
+            detector.push(token);
+        }
+        bool triggered = false;
+        for (int token : {1, 2, 3, 4}) {
+            triggered = detector.push(token);
+        }
+        REQUIRE(triggered == false);
+    }
+    
+    SECTION("ngram 0 disables detection") {
+        detector.configure(0, 2, 16);
+        REQUIRE(detector.push(1) == false);
+        REQUIRE(detector.push(1) == false);
+    }
+}
+
+TEST_CASE("RepetitionDetector defaults leave repeated code alone", "[inference]") {
+    InferenceConfig config;
+    RepetitionDetector detector;
+    detector.configure(config.repeat_stop_ngram, config.repeat_stop_count, config.repeat_stop_window);
+    
+    // A 40-token code block, e.g. a function shown before and after an edit
+    std::vector<int> block;
+    for (int i = 0; i < 40; i++) {
+        block.push_back(1000 + i);
+    }
+    
+    SECTION("A code block quoted several times between prose is not cut off") {
+        for (int copy = 0; copy < 4; copy++) {
+            for (int token : block) {
+                REQUIRE(detector.push(token) == false);
+            }
+            for (int token = 0; token < 20; token++) {
+                REQUIRE(detector.push(copy * 100 + token) == false);
+            }
+        }
+    }
+    
+    SECTION("A code block printed twice in a row is not cut off") {
+        for (int copy = 0; copy < 2; copy++) {
+            for (int token : block) {
+                REQUIRE(detector.push(token) == false);
+            }
+        }
+    }
+    
+    SECTION("The same block looping on and on is stopped") {
+        bool triggered = false;
+        for (int copy = 0; copy < 4 && !triggered; copy++) {
+            for (size_t i = 0; i < block.size() && !triggered; i++) {
+                triggered = detector.push(block[i]);
+            }
+        }
+        REQUIRE(triggered);
+    }
+}
+
+TEST_CASE("EarlyStop heuristics", "[inference]") {
+    InferenceConfig config;
+    config.sentence_stop_tokens = 2;
+    config.repeat_stop_ngram = 2;
+    config.repeat_stop_count = 2;
+    config.repeat_stop_window = 16;
+    EarlyStop stop;
+    stop.configure(config);
+    
+    // Schema-constrained output whose string value ends a sentence
+    const std::vector<std::string> pieces = {"{\"", "version", "\":", " \"", "v", "1", ".", "2", ".", "\"}"};
+    
+    SECTION("Unconstrained output stops at the first sentence end") {
+        stop.reset(false);
+        size_t n = 0;
+        while (n < pieces.size() && !stop.push(static_cast<int>(n), pieces[n])) {
+            n++;
+        }
+        REQUIRE(n == 6);
+    }
+    
+    SECTION("Constrained output with a sentence-ending value stays parseable") {
+        stop.reset(true);
+        std::string text;
+        for (size_t i = 0; i < pieces.size(); i++) {
+            REQUIRE(stop.push(static_cast<int>(i), pieces[i]) == false);
+            text += pieces[i];
+        }
+        nlohmann::json parsed = nlohmann::json::parse(text);
+        REQUIRE(parsed["version"] == "v1.2.");
+    }
+    
+    SECTION("Constrained output ignores repetition") {
+        stop.reset(true);
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(stop.push(i % 2, ",") == false);
+        }
+        stop.reset(false);
+        bool triggered = false;
+        for (int i = 0; i < 4 && !triggered; i++) {
+            triggered = stop.push(i % 2, ",");
+        }
+        REQUIRE(triggered);
+    }
+}
+
+TEST_CASE("Generation hot path benchmark", "[.][benchmark][inference]") {
+    RepetitionDetector detector;
+    detector.configure(12, 2, 256);
+    IncrementalDetokenizer detok;
+    int token = 0;
+    
+    BENCHMARK("RepetitionDetector::push") {
+        return detector.push(token++ % 5000);
+    };
+    
+    BENCHMARK("IncrementalDetokenizer::push") {
+        return detok.push(" token").size();
+    };
+}
+
 // Note: Full integration tests would require an actual model file
 // These tests focus on API behavior without requiring model files
 TEST_CASE("InferenceEngine integration scenarios", "[inference][integration]") {
@@ -116,3 +395,75 @@ TEST_CASE("InferenceEngine integration scenarios", "[inference][integration]") {
     }
 }
 
+
+TEST_CASE("ModelHandle and EnginePool", "[inference]") {
+    InferenceConfig config;
+    config.model_path = "/non/existent.gguf";
+    
+    SECTION("Missing model file yields no handle") {
+        REQUIRE(ModelHandle::load(config.model_path, config) == nullptr);
+    }
+    
+    SECTION("Engine rejects a null model handle") {
+        InferenceEngine engine;
+        REQUIRE_FALSE(engine.load_model(std::shared_ptr<ModelHandle>(), config));
+        REQUIRE(engine.is_loaded() == false);
+        REQUIRE(engine.get_model() == nullptr);
+    }
+    
+    SECTION("Pool fails to load a missing model") {
+        EnginePool pool;
+        REQUIRE_FALSE(pool.load(config, 4));
+        REQUIRE(pool.model() == nullptr);
+        REQUIRE(pool.size() == 0);
+    }
+    
+    SECTION("Acquiring from an unloaded pool throws") {
+        EnginePool pool;
+        REQUIRE_THROWS_AS(pool.acquire(), std::runtime_error);
+        REQUIRE_THROWS_AS(pool.try_acquire(), std::runtime_error);
+    }
+    
+    SECTION("Empty lease") {
+        EnginePool::Lease lease;
+        REQUIRE_FALSE(lease);
+        lease.release();
+        REQUIRE_FALSE(lease);
+    }
+}
+
+TEST_CASE("Asynchronous generation handle", "[inference]") {
+    SECTION("Empty handle") {
+        GenerationHandle handle;
+        REQUIRE_FALSE(handle.valid());
+        std::string piece;
+        REQUIRE_FALSE(handle.next_piece(piece));
+        handle.cancel();
+        REQUIRE_FALSE(handle.result().valid());
+    }
+    
+    SECTION("Requires a loaded model") {
+        InferenceEngine engine;
+        REQUIRE_THROWS_AS(engine.generate_async("Hello", 8), std::runtime_error);
+    }
+}
+
+TEST_CASE("Grammar constraints", "[inference]") {
+    InferenceEngine engine;
+    
+    SECTION("Clearing the constraint works without a model") {
+        REQUIRE(engine.set_grammar(""));
+        REQUIRE(engine.set_json_schema(""));
+    }
+    
+    SECTION("Setting a constraint requires a loaded model") {
+        REQUIRE_THROWS_AS(engine.set_grammar("root ::= \"yes\" | \"no\""), std::runtime_error);
+        REQUIRE_THROWS_AS(engine.set_json_schema("{\"type\": \"object\"}"), std::runtime_error);
+    }
+    
+    SECTION("Config defaults to unconstrained output") {
+        InferenceConfig config;
+        REQUIRE(config.grammar.empty());
+        REQUIRE(config.json_schema.empty());
+    }
+}
@@ -5,6 +5,8 @@
 #include <catch2/catch_test_macros.hpp>
 #include "../src/delta_cli.h"
 #include "../src/tools/file_ops.cpp"
+#include <filesystem>
+#include <fstream>
 
 using namespace delta;
 
@@ -59,6 +61,12 @@ TEST_CASE("ModelManager path operations", "[models]") {
         // Will be empty if file doesn't exist, or abs_path if it does
         REQUIRE((result.empty() || result == abs_path));
     }
+    
+    SECTION("get_mmproj_path() sits next to the model and is not a .gguf") {
+        REQUIRE(ModelManager::get_mmproj_path("/models/gemma-3-4b-it-Q4_K_M.gguf") ==
+                "/models/gemma-3-4b-it-Q4_K_M.mmproj");
+        REQUIRE(ModelManager::get_mmproj_path("/models/custom-model") == "/models/custom-model.mmproj");
+    }
 }
 
 TEST_CASE("ModelManager info operations", "[models]") {
@@ -133,6 +141,12 @@ TEST_CASE("ModelManager registry operations", "[models][registry]") {
         REQUIRE(entry.filename == "Qwen3-0.6B-Q4_K_M.gguf");
         REQUIRE(entry.quantization == "Q4_K_M");
         REQUIRE(entry.size_bytes == 400LL * 1024 * 1024);
+        REQUIRE(entry.mmproj_filename.empty());
+    }
+    
+    SECTION("vision models ship a projector") {
+        REQUIRE(mgr.get_registry_entry("gemma3:4b").mmproj_filename == "mmproj-model-f16.gguf");
+        REQUIRE(!mgr.get_registry_entry("qwen2.5vl:3b").mmproj_filename.empty());
     }
 }
 
@@ -336,3 +350,229 @@ TEST_CASE("ModelManager verified model mappings", "[models][verified]") {
     }
 }
 
+
+TEST_CASE("DownloadJob state", "[models][download]") {
+    SECTION("New job is queued with no progress") {
+        DownloadJob job("qwen3:0.6b");
+        REQUIRE(job.model_name() == "qwen3:0.6b");
+        REQUIRE(job.state() == DownloadJob::State::Queued);
+        REQUIRE_FALSE(job.finished());
+        REQUIRE_FALSE(job.cancel_requested());
+        REQUIRE(job.current_bytes() == 0);
+    }
+    
+    SECTION("Progress is recorded and forwarded to the job's own callback") {
+        long long seen = 0;
+        DownloadJob job("qwen3:0.6b", [&seen](double, long long current, long long) { seen = current; });
+        job.report_progress(50.0, 512, 1024);
+        REQUIRE(job.progress() == 50.0);
+        REQUIRE(job.total_bytes() == 1024);
+        REQUIRE(seen == 512);
+    }
+    
+    SECTION("A job cancelled before it starts finishes without downloading") {
+        ModelManager mgr;
+        DownloadJob job("qwen3:0.6b");
+        job.cancel();
+        REQUIRE_FALSE(mgr.pull_model(job));
+        REQUIRE(job.state() == DownloadJob::State::Cancelled);
+    }
+}
+
+TEST_CASE("DownloadScheduler", "[models][download]") {
+    ModelManager mgr;
+    
+    SECTION("Concurrency limit is at least one") {
+        DownloadScheduler scheduler(mgr, 0);
+        REQUIRE(scheduler.max_concurrent() == 1);
+    }
+    
+    SECTION("Unknown models fail and leave the scheduler idle") {
+        DownloadScheduler scheduler(mgr, 2);
+        bool finished = false;
+        auto job = scheduler.submit("nonexistent-model-xyz", nullptr,
+                                    [&finished](DownloadJob&) { finished = true; });
+        REQUIRE_FALSE(job->wait());
+        scheduler.wait_all();
+        REQUIRE(finished);
+        REQUIRE(job->state() == DownloadJob::State::Failed);
+        REQUIRE(scheduler.find("nonexistent-model-xyz") == nullptr);
+    }
+    
+    SECTION("Cancelling a model with no job reports false") {
+        DownloadScheduler scheduler(mgr);
+        REQUIRE_FALSE(scheduler.cancel("nonexistent-model-xyz"));
+        REQUIRE_FALSE(mgr.cancel_download("nonexistent-model-xyz"));
+    }
+}
+
+TEST_CASE("DownloadResume sidecar and validators", "[models][download][resume]") {
+    const std::string meta_path = (std::filesystem::temp_directory_path() / "delta-test-resume.meta").string();
+    
+    ResumeInfo saved;
+    saved.url = "https://huggingface.co/org/repo/resolve/main/model.gguf";
+    saved.etag = "\"abc123\"";
+    saved.last_modified = "Wed, 01 Oct 2025 10:00:00 GMT";
+    saved.size = 100LL * 1024 * 1024;
+    
+    SECTION("Sidecar round-trips every persisted field") {
+        ResumeInfo::Segment first;
+        first.start = 0;
+        first.end = 50LL * 1024 * 1024;
+        first.done = 1234;
+        ResumeInfo::Segment second;
+        second.start = first.end;
+        second.end = saved.size;
+        second.done = second.end - second.start;
+        saved.segments = {first, second};
+        saved.hash_state = "64 " + std::string(64, 'a');
+        saved.accept_ranges = true;
+        DownloadResume::write(meta_path, saved);
+        
+        ResumeInfo loaded;
+        REQUIRE(DownloadResume::read(meta_path, loaded));
+        REQUIRE(loaded.url == saved.url);
+        REQUIRE(loaded.etag == saved.etag);
+        REQUIRE(loaded.last_modified == saved.last_modified);
+        REQUIRE(loaded.size == saved.size);
+        REQUIRE(loaded.hash_state == saved.hash_state);
+        REQUIRE(loaded.segments.size() == 2);
+        REQUIRE(loaded.segments[0].done == 1234);
+        REQUIRE_FALSE(loaded.segments[0].complete());
+        REQUIRE(loaded.segments[1].start == first.end);
+        REQUIRE(loaded.segments[1].complete());
+        REQUIRE_FALSE(loaded.accept_ranges);
+        std::filesystem::remove(meta_path);
+    }
+    
+    SECTION("A missing or corrupt sidecar is rejected") {
+        std::filesystem::remove(meta_path);
+        ResumeInfo loaded;
+        REQUIRE_FALSE(DownloadResume::read(meta_path, loaded));
+        
+        std::ofstream(meta_path) << "url\thttps://example.com/a.gguf\nsegment\t0 x 0\n";
+        REQUIRE_FALSE(DownloadResume::read(meta_path, loaded));
+        std::filesystem::remove(meta_path);
+    }
+    
+    SECTION("Unchanged validators allow resuming") {
+        ResumeInfo remote = saved;
+        REQUIRE(DownloadResume::same_remote_file(saved, remote));
+    }
+    
+    SECTION("A changed ETag restarts the download") {
+        ResumeInfo remote = saved;
+        remote.etag = "\"def456\"";
+        REQUIRE_FALSE(DownloadResume::same_remote_file(saved, remote));
+    }
+    
+    SECTION("A changed Last-Modified restarts when there is no strong ETag") {
+        ResumeInfo remote = saved;
+        remote.etag = "W/\"abc123\"";
+        REQUIRE(DownloadResume::same_remote_file(saved, remote));
+        remote.last_modified = "Thu, 02 Oct 2025 10:00:00 GMT";
+        REQUIRE_FALSE(DownloadResume::same_remote_file(saved, remote));
+    }
+    
+    SECTION("A changed size or a server without validators restarts") {
+        ResumeInfo remote = saved;
+        remote.size = saved.size + 1;
+        REQUIRE_FALSE(DownloadResume::same_remote_file(saved, remote));
+        
+        remote = saved;
+        remote.etag.clear();
+        remote.last_modified.clear();
+        REQUIRE_FALSE(DownloadResume::has_validator(remote));
+        REQUIRE_FALSE(DownloadResume::same_remote_file(saved, remote));
+    }
+}
+
+TEST_CASE("DownloadResume response handling", "[models][download][resume]") {
+    SECTION("Headers of the last hop win; X-Linked-Etag of the first is kept") {
+        const std::string digest(64, 'f');
+        ResumeInfo info;
+        for (const char* header : {"HTTP/1.1 302 Found\r\n",
+                                   "ETag: \"redirect\"\r\n",
+                                   "Content-Length: 1\r\n"}) {
+            DownloadResume::parse_header(header, info);
+        }
+        DownloadResume::parse_header("X-Linked-Etag: \"" + digest + "\"\r\n", info);
+        for (const char* header : {"HTTP/1.1 200 OK\r\n",
+                                   "etag: \"cdn-etag\"\r\n",
+                                   "Last-Modified: Wed, 01 Oct 2025 10:00:00 GMT\r\n",
+                                   "Content-Length: 4096\r\n",
+                                   "Accept-Ranges: bytes\r\n",
+                                   "\r\n"}) {
+            DownloadResume::parse_header(header, info);
+        }
+        REQUIRE(info.etag == "\"cdn-etag\"");
+        REQUIRE(info.last_modified == "Wed, 01 Oct 2025 10:00:00 GMT");
+        REQUIRE(info.size == 4096);
+        REQUIRE(info.accept_ranges);
+        REQUIRE(info.linked_sha256 == digest);
+    }
+    
+    SECTION("A 200 answer to a Range request restarts from zero") {
+        REQUIRE(DownloadResume::range_ignored(1024, 200));
+        REQUIRE_FALSE(DownloadResume::range_ignored(1024, 206));
+        REQUIRE_FALSE(DownloadResume::range_ignored(0, 200));
+    }
+}
+
+TEST_CASE("DownloadResume segment planning", "[models][download][resume]") {
+    const long long kMin = DownloadResume::kMinSegmentBytes;
+    
+    SECTION("A remainder smaller than one segment is a single range") {
+        auto segments = DownloadResume::plan_segments(0, kMin - 1, 4);
+        REQUIRE(segments.size() == 1);
+        REQUIRE(segments[0].start == 0);
+        REQUIRE(segments[0].end == kMin - 1);
+        REQUIRE(segments[0].done == 0);
+    }
+    
+    SECTION("Segments are contiguous and the last one ends at the file size") {
+        const long long size = 3 * kMin + kMin / 2 + 7;
+        auto segments = DownloadResume::plan_segments(0, size, 8);
+        REQUIRE(segments.size() == 3);
+        for (size_t i = 1; i < segments.size(); i++) {
+            REQUIRE(segments[i].start == segments[i - 1].end);
+        }
+        REQUIRE(segments.back().end == size);
+        
+        segments = DownloadResume::plan_segments(0, 10 * kMin + 3, 4);
+        REQUIRE(segments.size() == 4);
+        REQUIRE(segments.back().end == 10 * kMin + 3);
+    }
+    
+    SECTION("A single-stream partial becomes the first, complete, segment") {
+        const long long offset = 5 * kMin + 123;
+        const long long size = 10 * kMin;
+        auto segments = DownloadResume::resume_segments(nullptr, offset, size, 4);
+        REQUIRE(segments.size() == 5);
+        REQUIRE(segments[0].start == 0);
+        REQUIRE(segments[0].end == offset);
+        REQUIRE(segments[0].complete());
+        REQUIRE(segments[1].start == offset);
+        REQUIRE(segments[1].done == 0);
+        REQUIRE(segments.back().end == size);
+    }
+    
+    SECTION("Saved segments are continued as they are") {
+        ResumeInfo saved;
+        saved.segments = {ResumeInfo::Segment{0, 100, 40}, ResumeInfo::Segment{100, 200, 100}};
+        auto segments = DownloadResume::resume_segments(&saved, 0, 200, 4);
+        REQUIRE(segments.size() == 2);
+        REQUIRE(segments[0].done == 40);
+        REQUIRE(segments[1].complete());
+    }
+    
+    SECTION("Hashing can run up to the first gap after its position") {
+        std::vector<ResumeInfo::Segment> segments = {ResumeInfo::Segment{0, 100, 100},
+                                                     ResumeInfo::Segment{100, 200, 30},
+                                                     ResumeInfo::Segment{200, 300, 100}};
+        REQUIRE(DownloadResume::hashable_end(segments, 50) == 100);
+        REQUIRE(DownloadResume::hashable_end(segments, 100) == 130);
+        REQUIRE(DownloadResume::hashable_end(segments, 130) == 130);
+        REQUIRE(DownloadResume::hashable_end(segments, 300) == 300);
+    }
+}
@@ -4,6 +4,7 @@
 
 #include <catch2/catch_test_macros.hpp>
 #include "../src/delta_cli.h"
+#include <sys/stat.h>
 
 using namespace delta;
 using namespace delta::tools;
@@ -98,6 +99,27 @@ TEST_CASE("FileOps directory operations", "[tools][fileops]") {
     }
 }
 
+TEST_CASE("FileOps prefetch", "[tools][fileops]") {
+    SECTION("prefetch_file() fails for missing or empty files") {
+        REQUIRE_FALSE(FileOps::prefetch_file("/non/existent/model.gguf"));
+        
+        std::string empty_file = FileOps::join_path(FileOps::get_home_dir(), ".delta-test-empty.bin");
+        REQUIRE(FileOps::write_file(empty_file, ""));
+        REQUIRE_FALSE(FileOps::prefetch_file(empty_file));
+        std::remove(empty_file.c_str());
+    }
+    
+#ifndef _WIN32
+    SECTION("prefetch_file() leaves the file untouched") {
+        std::string test_file = FileOps::join_path(FileOps::get_home_dir(), ".delta-test-prefetch.bin");
+        REQUIRE(FileOps::write_file(test_file, "model weights"));
+        REQUIRE(FileOps::prefetch_file(test_file));
+        REQUIRE(FileOps::read_file(test_file) == "model weights");
+        std::remove(test_file.c_str());
+    }
+#endif
+}
+
 TEST_CASE("DepProtocol command execution", "[tools][depprotocol]") {
     SECTION("execute() runs simple command") {
 #ifdef _WIN32
@@ -166,3 +188,146 @@ TEST_CASE("Shell operations", "[tools][shell]") {
     }
 }
 
+
+TEST_CASE("Hash helpers", "[tools][hash]") {
+    SECTION("fnv1a64() matches the reference values") {
+        REQUIRE(Hash::fnv1a64("", 0) == 14695981039346656037ULL);
+        REQUIRE(Hash::fnv1a64("a", 1) == 0xaf63dc4c8601ec8cULL);
+    }
+    
+    SECTION("to_hex() is zero-padded to 16 digits") {
+        REQUIRE(Hash::to_hex(0) == "0000000000000000");
+        REQUIRE(Hash::to_hex(0xabcULL) == "0000000000000abc");
+    }
+    
+    SECTION("file_fingerprint() is stable and content dependent") {
+        std::string test_file = FileOps::join_path(FileOps::get_home_dir(), ".delta-test-hash.bin");
+        REQUIRE(FileOps::write_file(test_file, "model weights"));
+        std::string first = Hash::file_fingerprint(test_file);
+        REQUIRE(first.size() == 16);
+        REQUIRE(Hash::file_fingerprint(test_file) == first);
+        
+        REQUIRE(FileOps::write_file(test_file, "other weights"));
+        REQUIRE(Hash::file_fingerprint(test_file) != first);
+        std::remove(test_file.c_str());
+    }
+    
+    SECTION("file_fingerprint() returns empty for missing files") {
+        REQUIRE(Hash::file_fingerprint("/non/existent/model.gguf").empty());
+    }
+}
+
+TEST_CASE("Sha256 streaming digest", "[tools][hash]") {
+    SECTION("Matches the FIPS 180-2 test vectors") {
+        REQUIRE(Sha256().hex_digest() == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+        Sha256 abc;
+        abc.update("abc", 3);
+        REQUIRE(abc.hex_digest() == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    }
+    
+    SECTION("Chunk boundaries do not change the digest") {
+        std::string data(1000000, 'a');
+        Sha256 chunked;
+        for (size_t i = 0; i < data.size(); i += 777) {
+            chunked.update(data.data() + i, std::min<size_t>(777, data.size() - i));
+        }
+        REQUIRE(chunked.bytes() == data.size());
+        REQUIRE(chunked.hex_digest() == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    }
+    
+    SECTION("A saved midstate continues to the same digest") {
+        std::string data(5000, 'x');
+        Sha256 whole;
+        whole.update(data.data(), data.size());
+        
+        Sha256 first;
+        first.update(data.data(), 1234);    // not block aligned
+        Sha256 resumed;
+        REQUIRE(resumed.load_state(first.save_state()));
+        resumed.update(data.data() + 1234, data.size() - 1234);
+        REQUIRE(resumed.hex_digest() == whole.hex_digest());
+    }
+    
+    SECTION("Malformed state is rejected") {
+        Sha256 sha;
+        REQUIRE_FALSE(sha.load_state(""));
+        REQUIRE_FALSE(sha.load_state("3 0123"));
+    }
+}
+
+TEST_CASE("SystemInfo topology and thread defaults", "[tools][systeminfo]") {
+    SECTION("cpu_topology() reports sane counts") {
+        const auto& topology = SystemInfo::cpu_topology();
+        REQUIRE(topology.logical_cores >= 1);
+        REQUIRE(topology.physical_cores >= 1);
+        REQUIRE(topology.physical_cores <= topology.logical_cores);
+        REQUIRE(topology.numa_nodes >= 1);
+    }
+    
+    SECTION("Decode threads never exceed batch threads") {
+        REQUIRE(SystemInfo::default_threads() >= 1);
+        REQUIRE(SystemInfo::default_threads() <= SystemInfo::default_threads_batch());
+    }
+    
+    SECTION("parse_numa_strategy() round-trips names") {
+        NumaStrategy strategy = NumaStrategy::Disabled;
+        REQUIRE(SystemInfo::parse_numa_strategy("isolate", strategy));
+        REQUIRE(strategy == NumaStrategy::Isolate);
+        REQUIRE(std::string(SystemInfo::numa_strategy_name(strategy)) == "isolate");
+        REQUIRE(SystemInfo::parse_numa_strategy("off", strategy));
+        REQUIRE(strategy == NumaStrategy::Disabled);
+        REQUIRE_FALSE(SystemInfo::parse_numa_strategy("everywhere", strategy));
+    }
+    
+    SECTION("llama_server_thread_args() passes the same policy to llama-server") {
+        std::string args = SystemInfo::llama_server_thread_args(6, 12, NumaStrategy::Distribute);
+        REQUIRE(args == " --threads 6 --threads-batch 12 --numa distribute");
+        REQUIRE(SystemInfo::llama_server_thread_args(0, 0, NumaStrategy::Disabled).find("--numa") == std::string::npos);
+    }
+}
+
+TEST_CASE("ServerFlags KV cache options", "[tools][serverflags]") {
+    SECTION("Cache type and flash attention names round-trip") {
+        KvCacheType type = KvCacheType::F16;
+        REQUIRE(ServerFlags::parse_kv_cache_type("q8_0", type));
+        REQUIRE(type == KvCacheType::Q8_0);
+        REQUIRE(std::string(ServerFlags::kv_cache_type_name(type)) == "q8_0");
+        REQUIRE_FALSE(ServerFlags::parse_kv_cache_type("q3_k", type));
+        
+        FlashAttention mode = FlashAttention::Auto;
+        REQUIRE(ServerFlags::parse_flash_attn("on", mode));
+        REQUIRE(mode == FlashAttention::On);
+        REQUIRE(std::string(ServerFlags::flash_attn_name(FlashAttention::Off)) == "off");
+        REQUIRE_FALSE(ServerFlags::parse_flash_attn("sometimes", mode));
+    }
+    
+    SECTION("Nothing is passed to a binary that cannot be probed") {
+        REQUIRE_FALSE(ServerFlags::supports("/non/existent/llama-server", "--flash-attn"));
+        REQUIRE(ServerFlags::kv_cache_args("/non/existent/llama-server", KvCacheType::Q8_0, KvCacheType::Q8_0,
+                                           FlashAttention::Auto).empty());
+    }
+    
+#ifndef _WIN32
+    SECTION("Options are taken from the server's --help output") {
+        std::string fake_server = FileOps::join_path(FileOps::get_home_dir(), ".delta-test-llama-server.sh");
+        REQUIRE(FileOps::write_file(fake_server,
+            "#!/bin/sh\n"
+            "echo '-fa,    --flash-attn [on|off|auto]   set Flash Attention use'\n"
+            "echo '-ctk,   --cache-type-k TYPE          KV cache data type for K'\n"
+            "echo '-ctv,   --cache-type-v TYPE          KV cache data type for V'\n"));
+        chmod(fake_server.c_str(), 0755);
+        
+        REQUIRE(ServerFlags::supports(fake_server, "--cache-type-k"));
+        REQUIRE_FALSE(ServerFlags::supports(fake_server, "--cache-type"));
+        REQUIRE_FALSE(ServerFlags::supports(fake_server, "--mmproj"));
+        
+        // A quantized V cache turns flash attention on
+        REQUIRE(ServerFlags::kv_cache_args(fake_server, KvCacheType::Q8_0, KvCacheType::Q4_0, FlashAttention::Auto) ==
+                " --flash-attn on --cache-type-k q8_0 --cache-type-v q4_0");
+        // ...unless it was switched off, then V stays f16
+        REQUIRE(ServerFlags::kv_cache_args(fake_server, KvCacheType::Q8_0, KvCacheType::Q8_0, FlashAttention::Off) ==
+                " --flash-attn off --cache-type-k q8_0");
+        std::remove(fake_server.c_str());
+    }
+#endif
+}
@@ -60,6 +60,29 @@ TEST_CASE("UI output methods", "[ui]") {
     std::cout.rdbuf(old);
 }
 
+TEST_CASE("UI download progress", "[ui]") {
+    std::stringstream buffer;
+    std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
+    
+    SECTION("Redraws are frame limited but the final frame is always drawn") {
+        UI::print_download_progress(100.0, 2 * 1024 * 1024, 2 * 1024 * 1024, "[Download a]");
+        buffer.str("");
+        
+        // Right after a frame, intermediate ticks are dropped...
+        UI::print_download_progress(10.0, 1024, 10240, "[Download a]");
+        UI::print_download_progress(20.0, 2048, 10240, "[Download a]");
+        REQUIRE(buffer.str().empty());
+        
+        // ...but completion is not
+        UI::print_download_progress(100.0, 10240, 10240, "[Download a]");
+        std::string output = buffer.str();
+        REQUIRE(output.find("[Download a]") != std::string::npos);
+        REQUIRE(output.find("100.0%") != std::string::npos);
+    }
+    
+    std::cout.rdbuf(old);
+}
+
 TEST_CASE("UI border printing", "[ui]") {
     std::stringstream buffer;
     std::streambuf* old = std::cout.rdbuf(buffer.rdbuf());
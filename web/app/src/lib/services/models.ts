@@ -13,6 +13,19 @@ export interface ModelInfo {
 	installed?: boolean;
 }
 
+/** Payload of an event on /api/models/download/events */
+export interface DownloadEvent {
+	model: string;
+	progress: number;
+	current_bytes: number;
+	total_bytes: number;
+	bytes_per_sec: number;
+	eta_seconds: number | null;
+	error_message?: string;
+}
+
+export type DownloadEventType = 'progress' | 'completed' | 'failed';
+
 export interface ModelListResponse {
 	models: ModelInfo[];
 }
@@ -163,7 +176,30 @@ export class ModelsService {
 	}
 
 	/**
-	 * Download a model (returns immediately, use getDownloadProgress to track)
+	 * Subscribe to progress of all downloads over Server-Sent Events.
+	 * onOpen runs once the stream is connected (and again after a reconnect); only
+	 * downloads started after that are guaranteed to have all their events delivered.
+	 * Returns a function that closes the stream.
+	 */
+	static subscribeDownloadEvents(
+		onEvent: (type: DownloadEventType, event: DownloadEvent) => void,
+		onError?: () => void,
+		onOpen?: () => void
+	): () => void {
+		const source = new EventSource(`${getModelApiBaseUrl()}/api/models/download/events`);
+		for (const type of ['progress', 'completed', 'failed'] as const) {
+			source.addEventListener(type, (message) => {
+				onEvent(type, JSON.parse((message as MessageEvent).data) as DownloadEvent);
+			});
+		}
+		source.onopen = () => onOpen?.();
+		source.onerror = () => onError?.();
+		return () => source.close();
+	}
+
+	/**
+	 * Download a model (returns immediately, track it with subscribeDownloadEvents
+	 * or getDownloadProgress)
 	 */
 	static async download(modelName: string): Promise<ModelOperationResponse> {
 		let response: Response;